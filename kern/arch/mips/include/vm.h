@@ -110,7 +110,8 @@ void ram_getsize(paddr_t *lo, paddr_t *hi);
 
 struct tlbshootdown {
 	/*
-	 * Change this to what you need for your VM design.
+	 * A page of an address space. The target CPU drops its entry
+	 * for it if the address space has a live ASID there.
 	 */
 	struct addrspace *ts_addrspace;
 	vaddr_t ts_vaddr;
@@ -118,5 +119,9 @@ struct tlbshootdown {
 
 #define TLBSHOOTDOWN_MAX 16
 
+#define TLBSHOOTDOWN_SAME(a, b) \
+	((a)->ts_addrspace == (b)->ts_addrspace && \
+	 (a)->ts_vaddr == (b)->ts_vaddr)
+
 
 #endif /* _MIPS_VM_H_ */
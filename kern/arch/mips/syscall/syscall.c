@@ -31,11 +31,13 @@
 #include <kern/errno.h>
 #include <kern/syscall.h>
 #include <lib.h>
+#include <cpustat.h>
 #include <mips/trapframe.h>
 #include <thread.h>
 #include <current.h>
 #include <syscall.h>
 #include <kern/wait.h>
+#include <copyinout.h>
 
 
 /*
@@ -82,12 +84,17 @@ syscall(struct trapframe *tf)
 	int callno;
 	int32_t retval;
 	int err;
+#ifdef UW
+	int fd;
+	off_t offset;
+#endif // UW
 
 	KASSERT(curthread != NULL);
 	KASSERT(curthread->t_curspl == 0);
 	KASSERT(curthread->t_iplhigh_count == 0);
 
 	callno = tf->tf_v0;
+	cpustat_inc(CPUSTAT_SYSCALL);
 
 	/*
 	 * Initialize retval to 0. Many of the system calls don't
@@ -136,6 +143,43 @@ syscall(struct trapframe *tf)
 	case SYS_execv:
 	  err = sys_execv((userptr_t) tf->tf_a0, (userptr_t) tf->tf_a1);
 	break;
+	case SYS_spawn:
+	  err = sys_spawn((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1,
+			  (pid_t *)&retval);
+	  break;
+	case SYS_sbrk:
+	  err = sys_sbrk((intptr_t)tf->tf_a0, (vaddr_t *)&retval);
+	  break;
+	case SYS_mmap:
+	  /* fd and the 64-bit offset are passed on the user stack */
+	  err = copyin((userptr_t)(tf->tf_sp + 16), &fd, sizeof(fd));
+	  if (err == 0) {
+	    err = copyin((userptr_t)(tf->tf_sp + 24), &offset, sizeof(offset));
+	  }
+	  if (err == 0) {
+	    err = sys_mmap((userptr_t)tf->tf_a0,
+			   (size_t)tf->tf_a1,
+			   (int)tf->tf_a2,
+			   (int)tf->tf_a3,
+			   fd, offset,
+			   (vaddr_t *)&retval);
+	  }
+	  break;
+	case SYS_munmap:
+	  err = sys_munmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1);
+	  break;
+	case SYS_msync:
+	  err = sys_msync((userptr_t)tf->tf_a0, (size_t)tf->tf_a1,
+			  (int)tf->tf_a2);
+	  break;
+	case SYS_open:
+	  err = sys_open((userptr_t)tf->tf_a0,
+			 (int)tf->tf_a1,
+			 (int *)&retval);
+	  break;
+	case SYS_close:
+	  err = sys_close((int)tf->tf_a0);
+	  break;
 #endif // UW
 
 	    /* Add stuff here */
@@ -32,11 +32,20 @@
 #include <lib.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <uio.h>
+#include <cpu.h>
 #include <proc.h>
 #include <current.h>
+#include <vnode.h>
 #include <mips/tlb.h>
+#include <platform/maxcpus.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <pagecache.h>
+#include <swap.h>
+#include <uw-vmstats.h>
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
@@ -45,32 +54,301 @@
  * assignment, this file is not included in your kernel!
  */
 
-/* under dumbvm, always have 48k of user stack */
-#define DUMBVM_STACKPAGES    12
+/*
+ * User stacks start out one page long and grow down, a page at a
+ * time, when the program faults below them, up to the address
+ * space's stack limit (DUMBVM_STACKLIMIT by default). They never get
+ * closer than DUMBVM_STACKGUARD pages to the region below, and the
+ * heap keeps the same distance from the lowest the stack could reach,
+ * so a runaway stack faults instead of quietly running into the heap.
+ */
+#define DUMBVM_STACKLIMIT    (1024 * 1024)
+#define DUMBVM_STACKGUARD    16
+
+/*
+ * Fault-around: when a TLB miss is for a resident page, also load
+ * entries for up to as_fawindow resident pages after it in the same
+ * region. The window doubles, up to DUMBVM_FAULTAROUND, each time the
+ * next miss is for the page just past the last window (a sequential
+ * sweep), and halves whenever it isn't.
+ */
+#define DUMBVM_FAULTAROUND   8
+
+/*
+ * What vm_pagein had to do to make a page resident, so that vm_fault
+ * can count it. Pages made resident other than by a fault (for
+ * as_copy) aren't counted at all.
+ */
+#define PAGEIN_NONE   0	/* resident already, or in the page cache */
+#define PAGEIN_ZERO   1	/* zero-filled */
+#define PAGEIN_ELF    2	/* read from the executable */
+#define PAGEIN_MMAP   3	/* read from an mmap'd file */
+#define PAGEIN_SWAP   4	/* read back from swap */
+
+/*
+ * Address space IDs.
+ *
+ * Each CPU hands out ASIDs in turn. When it runs out, it flushes its
+ * TLB and starts a new generation, which retires every ASID it handed
+ * out before. An address space remembers the CPU, ASID and generation
+ * it last ran with, and if it comes back to the same CPU in the same
+ * generation its TLB entries are still good. ASID 0 is never handed
+ * out, so the invalid entries written by vm_tlbflush can't match.
+ *
+ * Since an address space only has a live ASID on one CPU at a time,
+ * that is the only CPU that can have TLB entries it can use, so that
+ * is the only one that needs to hear about pages it loses.
+ *
+ * Indexed by cpu number, and only changed by that cpu, at splhigh.
+ * Handing out a new ASID, which changes ac_gen and ac_next here and
+ * the ASID fields of the address space, is done holding vm_lock
+ * (below), so that vm_evict sees them consistently. Coming back to
+ * an ASID that is still good takes no lock: switching is what ASIDs
+ * are meant to make cheap.
+ */
+#define ASID_MIN  1
+#define ASID_MAX  (TLBHI_PID >> TLBHI_PIDSHIFT)
+
+static struct {
+	uint32_t ac_next;	/* next ASID to hand out */
+	uint32_t ac_gen;	/* current generation; 0 until first use */
+	uint32_t ac_cur;	/* ASID of the address space now active */
+	struct cpu *ac_cpu;	/* the cpu, for shootdowns */
+} asidcpu[MAXCPUS];
+
+#define CURASID()  (asidcpu[curcpu->c_number].ac_cur)
+#define TLBHI(va)  ((va) | (CURASID() << TLBHI_PIDSHIFT))
 
 /*
- * Wrap rma_stealmem in a spinlock.
+ * Paging.
+ *
+ * When memory runs out, the thread that needs a frame pages out a
+ * user page to swap to get one (vm_evict). That means marking the
+ * owner's PTE busy, under its pt_lock, and getting rid of its TLB
+ * entry for the page. If the owner may be running on another CPU,
+ * that CPU is sent a TLB shootdown, and the evictor waits for it to
+ * be done before writing the page out, so that no store through the
+ * old entry can be lost. That is whichever CPU the owner has a live
+ * ASID on, whether or not it is running there right now; vm_lock
+ * keeps as_activate from moving it to a new one while we look. From
+ * then on the owner can't use the page without faulting, and the
+ * fault waits for the PTE to stop being busy.
+ *
+ * Picking the victim is a scan of the coremap, which can be long, so
+ * it isn't done under vm_lock but under evict_lock, which only keeps
+ * as_destroy from tearing down the owner under us.
+ *
+ * A process reads its own PTEs without locking, so it must not be
+ * switched out between seeing that a page is resident and loading it
+ * into the TLB; that is done at splhigh. A shootdown can't get in
+ * there either, so it finds the entry it was sent for.
  */
-static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+static struct spinlock vm_lock = SPINLOCK_INITIALIZER;
+static struct spinlock evict_lock = SPINLOCK_INITIALIZER;
 
 void
 vm_bootstrap(void)
 {
-	/* Do nothing. */
+	coremap_bootstrap();
+	vmstats_init();
+	pt_bootstrap();
+	pagecache_bootstrap();
+	swap_bootstrap();
+}
+
+/*
+ * Can pages of AS be paged out? Not if it's being torn down. Called
+ * with evict_lock held.
+ */
+static
+bool
+vm_evictable(struct addrspace *as)
+{
+	return !as->as_dying;
+}
+
+/*
+ * Get rid of any TLB entry for VADDR in AS, on this CPU at splhigh.
+ */
+static
+void
+vm_tlbinval(struct addrspace *as, vaddr_t vaddr)
+{
+	int i;
+
+	i = tlb_probe(vaddr | (as->as_asid << TLBHI_PIDSHIFT), 0);
+	if (i >= 0) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	tlb_setasid(CURASID());
+}
+
+/*
+ * Get rid of any TLB entry for VADDR in AS. If AS is running on
+ * another CPU, that CPU is sent a shootdown and returned, and *TICKET
+ * is set for ipi_tlbshootdown_wait, which the caller must call before
+ * counting on the entry being gone. Only vm_evict, with vm_lock held,
+ * can get that; anyone else passes NULL for TICKET, and must be
+ * working on its own address space at splhigh (as_activate has made
+ * it live on this CPU, if anywhere) or on one whose ASID as_destroy
+ * has dropped.
+ */
+static
+struct cpu *
+vm_tlbevict(struct addrspace *as, vaddr_t vaddr, unsigned *ticket)
+{
+	unsigned cpunum = curcpu->c_number;
+	struct tlbshootdown ts;
+	struct cpu *target;
+
+	if (as->as_asidgen == 0) {
+		/* never ran, or already lost its ASID */
+		return NULL;
+	}
+
+	if (as->as_asidcpu == cpunum) {
+		if (as->as_asidgen == asidcpu[cpunum].ac_gen) {
+			vm_tlbinval(as, vaddr);
+		}
+		return NULL;
+	}
+
+	if (as->as_asidgen != asidcpu[as->as_asidcpu].ac_gen) {
+		/* That CPU has flushed its TLB since. */
+		return NULL;
+	}
+
+	/* It may be running there, or go back there without a fault. */
+	KASSERT(ticket != NULL);
+	target = asidcpu[as->as_asidcpu].ac_cpu;
+	ts.ts_addrspace = as;
+	ts.ts_vaddr = vaddr;
+	*ticket = ipi_tlbshootdown(target, &ts);
+	vmstats_inc(VMSTAT_TLB_SHOOTDOWN);
+	return target;
+}
+
+/*
+ * Page out some user page to swap and hand its frame to OWNER.
+ * Returns 0 if there is no swap, or nothing that can be paged out.
+ * Sleeps.
+ */
+static
+paddr_t
+vm_evict(int owner)
+{
+	struct addrspace *as;
+	vaddr_t vaddr;
+	paddr_t paddr;
+	pte_t *pte, old;
+	struct cpu *target;
+	uint32_t slot;
+	unsigned ticket;
+	int result;
+
+	if (!swap_enabled() || curthread->t_in_interrupt) {
+		return 0;
+	}
+
+	result = swap_alloc(&slot);
+	if (result) {
+		return 0;
+	}
+
+	spinlock_acquire(&evict_lock);
+	result = coremap_victim(vm_evictable, &paddr, &as, &vaddr);
+	if (result) {
+		spinlock_release(&evict_lock);
+		swap_free(slot);
+		return 0;
+	}
+
+	/*
+	 * The owner backs off changing the entry while the frame is
+	 * busy in the coremap, so it is still what the coremap says.
+	 */
+	pte = pt_lookup(as->as_pt, vaddr, false);
+	KASSERT(pte != NULL);
+	spinlock_acquire(&as->as_pt->pt_lock);
+	old = *pte;
+	KASSERT((old & PTE_VALID) && (old & PTE_FRAME) == paddr);
+	KASSERT(!(old & PTE_COW));
+	*pte = (old & ~PTE_VALID) | PTE_BUSY;
+	spinlock_release(&as->as_pt->pt_lock);
+	spinlock_acquire(&vm_lock);
+	target = vm_tlbevict(as, vaddr, &ticket);
+	spinlock_release(&vm_lock);
+	spinlock_release(&evict_lock);
+
+	if (target != NULL) {
+		/* Until it's gone there, the owner can still store. */
+		ipi_tlbshootdown_wait(target, ticket);
+	}
+
+	DEBUG(DB_VM, "dumbvm: paging out 0x%x (0x%x) to slot %u\n",
+	      vaddr, paddr, slot);
+
+	result = swap_out(paddr, slot);
+	if (result) {
+		kprintf("dumbvm: swap write failed: %s\n", strerror(result));
+		pt_setentry(pte, old);
+		coremap_unbusy(paddr);
+		swap_free(slot);
+		return 0;
+	}
+
+	pt_setentry(pte, PTE_MKSWAP(slot) | (old & (PTE_WRITE | PTE_DIRTY)));
+	coremap_reclaim(paddr, owner);
+	return paddr;
 }
 
+/*
+ * Get physical pages for a user address space. (Kernel pages come
+ * from alloc_kpages.) Until vm_bootstrap runs these come from
+ * ram_stealmem. When memory runs out, first drop cached file pages
+ * nobody is using, then page something out.
+ *
+ * Reclaiming the page cache can sleep in the file system, so unlike
+ * vm_evict it isn't tried for kernel pages: kmalloc is called with
+ * file system locks held.
+ */
 static
 paddr_t
 getppages(unsigned long npages)
 {
-	paddr_t addr;
+	paddr_t pa;
+
+	pa = coremap_alloc(npages, CM_USER);
+	if (pa == 0 && pagecache_reclaim() > 0) {
+		pa = coremap_alloc(npages, CM_USER);
+	}
+	if (pa == 0 && npages == 1) {
+		pa = vm_evict(CM_USER);
+	}
+	return pa;
+}
 
-	spinlock_acquire(&stealmem_lock);
+/*
+ * Get a zero-filled page for a user address space, preferably one
+ * that an idle CPU has already zeroed.
+ */
+static
+paddr_t
+getzeroedpage(void)
+{
+	paddr_t pa;
 
-	addr = ram_stealmem(npages);
-	
-	spinlock_release(&stealmem_lock);
-	return addr;
+	pa = coremap_alloczero(CM_USER);
+	if (pa == 0 && pagecache_reclaim() > 0) {
+		pa = coremap_alloczero(CM_USER);
+	}
+	if (pa == 0) {
+		pa = vm_evict(CM_USER);
+		if (pa != 0) {
+			bzero((void *)PADDR_TO_KVADDR(pa), PAGE_SIZE);
+		}
+	}
+	return pa;
 }
 
 /* Allocate/free some kernel-space virtual pages */
@@ -78,7 +356,14 @@ vaddr_t
 alloc_kpages(int npages)
 {
 	paddr_t pa;
-	pa = getppages(npages);
+	pa = coremap_alloc(npages, CM_KERNEL);
+	if (pa == 0 && kheap_drain() > 0) {
+		pa = coremap_alloc(npages, CM_KERNEL);
+	}
+	if (pa == 0 && npages == 1 && curthread->t_iplhigh_count == 0) {
+		/* Only if we're not holding a spinlock. */
+		pa = vm_evict(CM_KERNEL);
+	}
 	if (pa==0) {
 		return 0;
 	}
@@ -88,33 +373,658 @@ alloc_kpages(int npages)
 void 
 free_kpages(vaddr_t addr)
 {
-	/* nothing - leak the memory. */
+	KASSERT(addr >= MIPS_KSEG0 && addr < MIPS_KSEG1);
+	coremap_free(addr - MIPS_KSEG0);
+}
+
+/*
+ * Find the region of AS containing VADDR, or NULL if there is none.
+ */
+static
+struct vm_region *
+as_findregion(struct addrspace *as, vaddr_t vaddr)
+{
+	struct vm_region *vr;
+
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		if (vaddr >= vr->vr_base &&
+		    vaddr < vr->vr_base + vr->vr_npages * PAGE_SIZE) {
+			return vr;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Return true if the page at VADDR in region VR has no file data in
+ * it and so starts out all zeroes.
+ */
+static
+bool
+region_zeropage(struct vm_region *vr, vaddr_t vaddr)
+{
+	vaddr_t fstart, fend;
+
+	if (vr->vr_vnode == NULL) {
+		return true;
+	}
+	fstart = vr->vr_fvaddr;
+	fend = fstart + vr->vr_filesize;
+	return vaddr + PAGE_SIZE <= fstart || vaddr >= fend;
+}
+
+/*
+ * Return a region of AS other than SKIP that overlaps [VBASE, VTOP),
+ * or NULL if there is none.
+ */
+static
+struct vm_region *
+as_overlaps(struct addrspace *as, vaddr_t vbase, vaddr_t vtop,
+	    struct vm_region *skip)
+{
+	struct vm_region *vr;
+
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		if (vr != skip &&
+		    vbase < vr->vr_base + vr->vr_npages * PAGE_SIZE &&
+		    vtop > vr->vr_base) {
+			return vr;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Grow the stack of AS down to cover VADDR, if VADDR is within the
+ * stack limit and the guard gap. Returns the stack region, or NULL.
+ */
+static
+struct vm_region *
+as_growstack(struct addrspace *as, vaddr_t vaddr)
+{
+	struct vm_region *stack = as->as_stack;
+	vaddr_t top, newbase;
 
-	(void)addr;
+	if (stack == NULL) {
+		return NULL;
+	}
+	top = stack->vr_base + stack->vr_npages * PAGE_SIZE;
+	newbase = vaddr & PAGE_FRAME;
+	if (vaddr >= stack->vr_base || newbase < top - as->as_stacklimit) {
+		return NULL;
+	}
+	if (newbase < DUMBVM_STACKGUARD * PAGE_SIZE ||
+	    as_overlaps(as, newbase - DUMBVM_STACKGUARD * PAGE_SIZE, top,
+			stack)) {
+		return NULL;
+	}
+
+	stack->vr_base = newbase;
+	stack->vr_npages = (top - newbase) / PAGE_SIZE;
+	if (stack->vr_npages > as->as_stackmax) {
+		as->as_stackmax = stack->vr_npages;
+	}
+	return stack;
+}
+
+/*
+ * Fill the freshly allocated frame PADDR with the contents of the
+ * page at VADDR in region VR: whatever part of the page lies within
+ * the region's file image is read from the file, and the rest is
+ * zeroed. Pages with no file data in them at all are handled by the
+ * caller (see region_zeropage).
+ *
+ * A short read means the file has shrunk since it was loaded or
+ * mapped. That is an error for an executable, but a mapping just
+ * sees zeroes past the new end of the file.
+ */
+static
+int
+region_fillpage(struct vm_region *vr, vaddr_t vaddr, paddr_t paddr)
+{
+	char *kpage = (char *)PADDR_TO_KVADDR(paddr);
+	vaddr_t fstart, fend, start, end;
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT(!region_zeropage(vr, vaddr));
+
+	fstart = vr->vr_fvaddr;
+	fend = fstart + vr->vr_filesize;
+	start = vaddr > fstart ? vaddr : fstart;
+	end = vaddr + PAGE_SIZE < fend ? vaddr + PAGE_SIZE : fend;
+
+	/* Zero whatever is not covered by the file data. */
+	bzero(kpage, start - vaddr);
+	bzero(kpage + (end - vaddr), vaddr + PAGE_SIZE - end);
+
+	uio_kinit(&iov, &ku, kpage + (start - vaddr), end - start,
+		  vr->vr_foffset + (start - fstart), UIO_READ);
+	result = VOP_READ(vr->vr_vnode, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		if (vr->vr_flags & VRF_MMAP) {
+			bzero(kpage + (end - vaddr) - ku.uio_resid,
+			      ku.uio_resid);
+			return 0;
+		}
+		/* short read; problem with executable? */
+		kprintf("ELF: short read on segment - file truncated?\n");
+		return ENOEXEC;
+	}
+	return 0;
 }
 
+/*
+ * Say what reading a page of region VR from its file counts as.
+ */
+static
+int
+region_pageinkind(struct vm_region *vr)
+{
+	return (vr->vr_flags & VRF_MMAP) ? PAGEIN_MMAP : PAGEIN_ELF;
+}
+
+/*
+ * Get the frame for the page at VADDR in the read-only region VR from
+ * the page cache, reading it in and adding it to the cache if it isn't
+ * there. The frame is shared with the cache, so it is never paged out.
+ * Sets *HIT if it was found in the cache, and nothing had to be read.
+ */
+static
+int
+region_cachedpage(struct vm_region *vr, vaddr_t vaddr, paddr_t *ret,
+		  bool *hit)
+{
+	off_t offset, fstart, fend;
+	paddr_t paddr;
+	int result;
+
+	KASSERT(!(vr->vr_perm & VR_WRITE));
+	KASSERT(!region_zeropage(vr, vaddr));
+
+	/* The file offset of the page may be before the segment. */
+	offset = vr->vr_foffset + ((off_t)vaddr - (off_t)vr->vr_fvaddr);
+	fstart = vr->vr_foffset;
+	fend = fstart + vr->vr_filesize;
+
+	paddr = pagecache_lookup(vr->vr_vnode, offset, fstart, fend);
+	if (paddr != 0) {
+		*ret = paddr;
+		*hit = true;
+		return 0;
+	}
+	*hit = false;
+
+	paddr = getppages(1);
+	if (paddr == 0) {
+		return ENOMEM;
+	}
+	result = region_fillpage(vr, vaddr, paddr);
+	if (result) {
+		coremap_free(paddr);
+		return result;
+	}
+	*ret = pagecache_insert(vr->vr_vnode, offset, fstart, fend, paddr);
+	return 0;
+}
+
+/*
+ * Write the dirty pages of the shared file mapping VR in AS back to
+ * the file, and mark them clean (and read-only, to catch the next
+ * write) again.
+ *
+ * Each page is copied to a buffer holding pt_lock, where it can't be
+ * paged out from under us, and written from there.
+ */
+static
+int
+region_writeback(struct addrspace *as, struct vm_region *vr)
+{
+	char *buf;
+	vaddr_t vaddr, fstart, fend, start, end;
+	pte_t *pte, old;
+	struct iovec iov;
+	struct uio ku;
+	bool wrote = false;
+	int result;
+
+	KASSERT(vr->vr_flags & VRF_SHARED);
+	KASSERT(vr->vr_vnode != NULL);
+
+	buf = kmalloc(PAGE_SIZE);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+
+	fstart = vr->vr_fvaddr;
+	fend = fstart + vr->vr_filesize;
+	for (vaddr = vr->vr_base; vaddr < fend; vaddr += PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, vaddr, false);
+		if (pte == NULL) {
+			continue;
+		}
+		while (1) {
+			if (*pte & PTE_BUSY) {
+				pt_waitbusy(pte);
+			}
+			spinlock_acquire(&as->as_pt->pt_lock);
+			old = *pte;
+			if (!(old & PTE_BUSY)) {
+				break;
+			}
+			/* picked for eviction again */
+			spinlock_release(&as->as_pt->pt_lock);
+		}
+		if (!(old & PTE_DIRTY)) {
+			spinlock_release(&as->as_pt->pt_lock);
+			continue;
+		}
+		if (old & PTE_VALID) {
+			memmove(buf, (void *)PADDR_TO_KVADDR(old & PTE_FRAME),
+				PAGE_SIZE);
+			vm_tlbevict(as, vaddr, NULL);
+		}
+		*pte = old & ~(PTE_DIRTY | PTE_WRITE);
+		spinlock_release(&as->as_pt->pt_lock);
+
+		if (old & PTE_SWAPPED) {
+			/* Only we swap our pages back in, so the slot stays. */
+			result = swap_in(PTE_SLOT(old),
+					 (paddr_t)buf - MIPS_KSEG0);
+			if (result) {
+				kfree(buf);
+				return result;
+			}
+		}
+
+		start = vaddr > fstart ? vaddr : fstart;
+		end = vaddr + PAGE_SIZE < fend ? vaddr + PAGE_SIZE : fend;
+		uio_kinit(&iov, &ku, buf + (start - vaddr), end - start,
+			  vr->vr_foffset + (start - fstart), UIO_WRITE);
+		result = VOP_WRITE(vr->vr_vnode, &ku);
+		if (result) {
+			kfree(buf);
+			return result;
+		}
+		wrote = true;
+	}
+
+	kfree(buf);
+	if (wrote) {
+		/* Don't hand out stale copies of what we just wrote. */
+		pagecache_invalidate(vr->vr_vnode);
+	}
+	return 0;
+}
+
+/*
+ * Give AS a private copy of the copy-on-write page at VADDR, mapped
+ * by PTE, and make it writeable. If nobody else still shares the
+ * frame it is simply taken over.
+ */
+static
+int
+vm_breakcow(struct addrspace *as, vaddr_t vaddr, pte_t *pte)
+{
+	paddr_t oldpa, newpa;
+
+	KASSERT(*pte & PTE_COW);
+	oldpa = *pte & PTE_FRAME;
+
+	/*
+	 * Only address spaces that already hold a reference can add
+	 * one, so if ours is the only one it stays that way.
+	 */
+	/* Being written, so dirty (which only matters if shared). */
+	if (coremap_refcount(oldpa) == 1) {
+		*pte = oldpa | PTE_VALID | PTE_WRITE | PTE_DIRTY;
+		coremap_setowner(oldpa, as, vaddr);
+		return 0;
+	}
+
+	newpa = getppages(1);
+	if (newpa == 0) {
+		return ENOMEM;
+	}
+	/* Copy before dropping our reference, or the frame may be reused. */
+	memmove((void *)PADDR_TO_KVADDR(newpa),
+		(const void *)PADDR_TO_KVADDR(oldpa), PAGE_SIZE);
+	coremap_free(oldpa);
+	*pte = newpa | PTE_VALID | PTE_WRITE | PTE_DIRTY;
+	coremap_setowner(newpa, as, vaddr);
+	return 0;
+}
+
+/*
+ * Make the page at VADDR in AS resident, and if WRITE, writeable.
+ * Sets *HOW to say how, if the page had to be zeroed or read in (see
+ * PAGEIN_*), and otherwise leaves it alone. May return without having
+ * done anything if it raced with the page being paged out; the caller
+ * checks and calls again.
+ */
+static
+int
+vm_pagein(struct addrspace *as, vaddr_t vaddr, bool write, int *how)
+{
+	struct vm_region *vr;
+	paddr_t paddr;
+	pte_t *pte;
+	uint32_t slot;
+	bool cached = false, hit = false;
+	int result;
+
+	pte = pt_lookup(as->as_pt, vaddr, false);
+	if (pte != NULL && (*pte & PTE_BUSY)) {
+		pt_waitbusy(pte);
+		return 0;
+	}
+	if (pte != NULL && (*pte & PTE_VALID)) {
+		if (write && (*pte & PTE_COW)) {
+			return vm_breakcow(as, vaddr, pte);
+		}
+		return 0;
+	}
+
+	if (pte != NULL && (*pte & PTE_SWAPPED)) {
+		/* Nobody but us touches it while it's in swap. */
+		slot = PTE_SLOT(*pte);
+		paddr = getppages(1);
+		if (paddr == 0) {
+			return ENOMEM;
+		}
+		result = swap_in(slot, paddr);
+		if (result) {
+			coremap_free(paddr);
+			return result;
+		}
+		*pte = paddr | PTE_VALID | (*pte & (PTE_WRITE | PTE_DIRTY));
+		swap_free(slot);
+		coremap_setowner(paddr, as, vaddr);
+		*how = PAGEIN_SWAP;
+		return 0;
+	}
+
+	/* Never touched; the region says whether it may be. */
+	vr = as_findregion(as, vaddr);
+	if (vr == NULL) {
+		vr = as_growstack(as, vaddr);
+		if (vr == NULL) {
+			return EFAULT;
+		}
+	}
+	pte = pt_lookup(as->as_pt, vaddr, true);
+	if (pte == NULL) {
+		return ENOMEM;
+	}
+	if (region_zeropage(vr, vaddr)) {
+		paddr = getzeroedpage();
+		if (paddr == 0) {
+			return ENOMEM;
+		}
+		*how = PAGEIN_ZERO;
+	}
+	else if (!(vr->vr_perm & VR_WRITE)) {
+		result = region_cachedpage(vr, vaddr, &paddr, &hit);
+		if (result) {
+			return result;
+		}
+		cached = true;
+		if (!hit) {
+			*how = region_pageinkind(vr);
+		}
+	}
+	else {
+		paddr = getppages(1);
+		if (paddr == 0) {
+			return ENOMEM;
+		}
+		result = region_fillpage(vr, vaddr, paddr);
+		if (result) {
+			coremap_free(paddr);
+			return result;
+		}
+		*how = region_pageinkind(vr);
+	}
+	/*
+	 * Pages of shared mappings stay read-only until written, so
+	 * that we find out which need writing back.
+	 */
+	*pte = paddr | PTE_VALID;
+	if (vr->vr_perm & VR_WRITE) {
+		if (!(vr->vr_flags & VRF_SHARED)) {
+			*pte |= PTE_WRITE;
+		}
+		else if (write) {
+			*pte |= PTE_WRITE | PTE_DIRTY;
+		}
+	}
+	if (!cached) {
+		coremap_setowner(paddr, as, vaddr);
+	}
+	return 0;
+}
+
+/*
+ * Make a TLB entry for a page.
+ */
+static
+uint32_t
+vm_tlbentry(paddr_t paddr, bool writeable)
+{
+	/* make sure it's page-aligned */
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	return paddr | TLBLO_VALID | (writeable ? TLBLO_DIRTY : 0);
+}
+
+/*
+ * Find a free slot in the TLB, at splhigh. Returns -1 if it's full.
+ */
+static
+int
+vm_tlbfreeslot(void)
+{
+	uint32_t ehi, elo;
+	int i;
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_read(&ehi, &elo, i);
+		if (!(elo & TLBLO_VALID)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Put a mapping for VADDR in the TLB, at splhigh. Use a free slot if
+ * there is one; otherwise let the processor pick a random victim
+ * among the non-wired slots. Returns true if a free slot was used.
+ */
+static
+bool
+vm_tlbinsert(vaddr_t vaddr, paddr_t paddr, bool writeable)
+{
+	int i;
+
+	i = vm_tlbfreeslot();
+	if (i >= 0) {
+		tlb_write(TLBHI(vaddr), vm_tlbentry(paddr, writeable), i);
+		return true;
+	}
+
+	tlb_random(TLBHI(vaddr), vm_tlbentry(paddr, writeable));
+	return false;
+}
+
+/*
+ * Load a mapping for VADDR, which just missed in the TLB.
+ */
+static
 void
-vm_tlbshootdown_all(void)
+vm_tlbload(vaddr_t vaddr, paddr_t paddr, bool writeable)
 {
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	int spl;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", vaddr, paddr);
+
+	if (vm_tlbinsert(vaddr, paddr, writeable)) {
+		vmstats_inc(VMSTAT_TLB_FAULT_FREE);
+	}
+	else {
+		vmstats_inc(VMSTAT_TLB_FAULT_REPLACE);
+	}
+	splx(spl);
+}
+
+/*
+ * Load entries for the resident pages following VADDR in AS, which
+ * just missed in the TLB, as far as the fault-around window reaches.
+ * Called at splhigh, like the load for VADDR itself, so none of them
+ * can be paged out before they're in the TLB. Only free slots are
+ * used: a random replacement could throw out the entry for VADDR,
+ * which would then miss again straight away.
+ */
+static
+void
+vm_faultaround(struct addrspace *as, vaddr_t vaddr)
+{
+	struct vm_region *vr;
+	vaddr_t va, top;
+	pte_t *pte;
+	unsigned n;
+	int slot;
+
+	if (vaddr == as->as_fanext) {
+		/* Ran off the end of the last window: sequential. */
+		as->as_fawindow = as->as_fawindow == 0 ? 1 :
+			as->as_fawindow * 2;
+		if (as->as_fawindow > DUMBVM_FAULTAROUND) {
+			as->as_fawindow = DUMBVM_FAULTAROUND;
+		}
+	}
+	else {
+		as->as_fawindow /= 2;
+	}
+
+	va = vaddr + PAGE_SIZE;
+	vr = as_findregion(as, vaddr);
+	if (as->as_fawindow > 0 && vr != NULL) {
+		top = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+		for (n = 0; n < as->as_fawindow && va < top; n++) {
+			pte = pt_lookup(as->as_pt, va, false);
+			if (pte == NULL || !(*pte & PTE_VALID)) {
+				break;
+			}
+			if (tlb_probe(TLBHI(va), 0) < 0) {
+				slot = vm_tlbfreeslot();
+				if (slot < 0) {
+					break;
+				}
+				tlb_write(TLBHI(va),
+					  vm_tlbentry(*pte & PTE_FRAME,
+						      (*pte & PTE_WRITE) != 0),
+					  slot);
+				vmstats_inc(VMSTAT_TLB_FAULTAROUND);
+			}
+			va += PAGE_SIZE;
+		}
+	}
+	as->as_fanext = va;
+}
+
+/*
+ * Replace the TLB entry for VADDR, if it is still there. If it was
+ * evicted, the next access will miss and load the new mapping.
+ */
+static
+void
+vm_tlbupdate(vaddr_t vaddr, paddr_t paddr, bool writeable)
+{
+	int i, spl;
+
+	spl = splhigh();
+	i = tlb_probe(TLBHI(vaddr), 0);
+	if (i >= 0) {
+		tlb_write(TLBHI(vaddr), vm_tlbentry(paddr, writeable), i);
+	}
+	splx(spl);
+}
+
+/*
+ * Let through the first write to the clean page at VADDR, mapped by
+ * PTE, if it belongs to a shared writeable mapping, and remember that
+ * it has to be written back.
+ */
+static
+int
+vm_markdirty(struct addrspace *as, vaddr_t vaddr, pte_t *pte)
+{
+	struct vm_region *vr;
+
+	vr = as_findregion(as, vaddr);
+	if (vr == NULL || !(vr->vr_flags & VRF_SHARED) ||
+	    !(vr->vr_perm & VR_WRITE)) {
+		return EFAULT;
+	}
+
+	spinlock_acquire(&as->as_pt->pt_lock);
+	if (*pte & PTE_VALID) {
+		*pte |= PTE_WRITE | PTE_DIRTY;
+		vm_tlbupdate(vaddr, *pte & PTE_FRAME, true);
+	}
+	/* Otherwise it was paged out; the retried store faults it in. */
+	spinlock_release(&as->as_pt->pt_lock);
+	return 0;
 }
 
+/*
+ * Count a TLB fault, and what vm_pagein did about it (HOW).
+ * A page found in the page cache counts as a reload: nothing was read.
+ */
+static
 void
-vm_tlbshootdown(const struct tlbshootdown *ts)
+vm_countfault(int how)
 {
-	(void)ts;
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	vmstats_inc(VMSTAT_TLB_FAULT);
+	switch (how) {
+	    case PAGEIN_NONE:
+		vmstats_inc(VMSTAT_TLB_RELOAD);
+		break;
+	    case PAGEIN_ZERO:
+		vmstats_inc(VMSTAT_PAGE_FAULT_ZERO);
+		break;
+	    case PAGEIN_ELF:
+		vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+		vmstats_inc(VMSTAT_ELF_FILE_READ);
+		break;
+	    case PAGEIN_MMAP:
+		vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+		vmstats_inc(VMSTAT_MMAP_FILE_READ);
+		break;
+	    case PAGEIN_SWAP:
+		vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+		vmstats_inc(VMSTAT_SWAP_FILE_READ);
+		break;
+	    default:
+		panic("vm_countfault: bad pagein %d\n", how);
+	}
 }
 
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
-	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
-	paddr_t paddr;
-	int i;
-	uint32_t ehi, elo;
+	pte_t *pte;
 	struct addrspace *as;
-	int spl;
+	bool write;
+	int how, spl, result;
 
 	faultaddress &= PAGE_FRAME;
 
@@ -122,8 +1032,6 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 
 	switch (faulttype) {
 	    case VM_FAULT_READONLY:
-		/* We always create pages read-write, so we can't get this */
-		panic("dumbvm: got VM_FAULT_READONLY\n");
 	    case VM_FAULT_READ:
 	    case VM_FAULT_WRITE:
 		break;
@@ -149,62 +1057,97 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		return EFAULT;
 	}
 
-	/* Assert that the address space has been set up properly. */
-	KASSERT(as->as_vbase1 != 0);
-	KASSERT(as->as_pbase1 != 0);
-	KASSERT(as->as_npages1 != 0);
-	KASSERT(as->as_vbase2 != 0);
-	KASSERT(as->as_pbase2 != 0);
-	KASSERT(as->as_npages2 != 0);
-	KASSERT(as->as_stackpbase != 0);
-	KASSERT((as->as_vbase1 & PAGE_FRAME) == as->as_vbase1);
-	KASSERT((as->as_pbase1 & PAGE_FRAME) == as->as_pbase1);
-	KASSERT((as->as_vbase2 & PAGE_FRAME) == as->as_vbase2);
-	KASSERT((as->as_pbase2 & PAGE_FRAME) == as->as_pbase2);
-	KASSERT((as->as_stackpbase & PAGE_FRAME) == as->as_stackpbase);
-
-	vbase1 = as->as_vbase1;
-	vtop1 = vbase1 + as->as_npages1 * PAGE_SIZE;
-	vbase2 = as->as_vbase2;
-	vtop2 = vbase2 + as->as_npages2 * PAGE_SIZE;
-	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
-	stacktop = USERSTACK;
-
-	if (faultaddress >= vbase1 && faultaddress < vtop1) {
-		paddr = (faultaddress - vbase1) + as->as_pbase1;
-	}
-	else if (faultaddress >= vbase2 && faultaddress < vtop2) {
-		paddr = (faultaddress - vbase2) + as->as_pbase2;
-	}
-	else if (faultaddress >= stackbase && faultaddress < stacktop) {
-		paddr = (faultaddress - stackbase) + as->as_stackpbase;
+	if (faulttype == VM_FAULT_READONLY) {
+		/*
+		 * A store to a page mapped read-only: either a real
+		 * protection violation, such as writing the text
+		 * segment, the first write to a clean page of a shared
+		 * mapping, or the first write to a copy-on-write page.
+		 * (Those are shared, so they can't be paged out under
+		 * us.)
+		 */
+		pte = pt_lookup(as->as_pt, faultaddress, false);
+		if (pte == NULL) {
+			return EFAULT;
+		}
+		if (!(*pte & PTE_COW)) {
+			return vm_markdirty(as, faultaddress, pte);
+		}
+		result = vm_breakcow(as, faultaddress, pte);
+		if (result) {
+			return result;
+		}
+		spl = splhigh();
+		if (*pte & PTE_VALID) {
+			vm_tlbupdate(faultaddress, *pte & PTE_FRAME, true);
+		}
+		splx(spl);
+		return 0;
 	}
-	else {
-		return EFAULT;
+
+	write = (faulttype == VM_FAULT_WRITE);
+	how = PAGEIN_NONE;
+	while (1) {
+		spl = splhigh();
+		pte = pt_lookup(as->as_pt, faultaddress, false);
+		if (pte != NULL && (*pte & PTE_VALID) &&
+		    !(write && (*pte & PTE_COW))) {
+			vm_countfault(how);
+			coremap_touch(*pte & PTE_FRAME);
+			vm_tlbload(faultaddress, *pte & PTE_FRAME,
+				   (*pte & PTE_WRITE) != 0);
+			vm_faultaround(as, faultaddress);
+			splx(spl);
+			return 0;
+		}
+		splx(spl);
+
+		result = vm_pagein(as, faultaddress, write, &how);
+		if (result) {
+			return result;
+		}
 	}
+}
 
-	/* make sure it's page-aligned */
-	KASSERT((paddr & PAGE_FRAME) == paddr);
+/*
+ * Add a region covering NPAGES pages from VBASE to AS, with no pages
+ * resident and no backing file. Regions may not overlap. If RET is
+ * not NULL the new region is handed back in it.
+ */
+static
+int
+as_addregion(struct addrspace *as, vaddr_t vbase, size_t npages,
+	     unsigned perm, struct vm_region **ret)
+{
+	struct vm_region *vr, **tailp;
 
-	/* Disable interrupts on this CPU while frobbing the TLB. */
-	spl = splhigh();
+	if (as_overlaps(as, vbase, vbase + npages * PAGE_SIZE, NULL)) {
+		return EINVAL;
+	}
+	for (tailp = &as->as_regions; *tailp != NULL;
+	     tailp = &(*tailp)->vr_next) {
+		/* nothing */
+	}
 
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_read(&ehi, &elo, i);
-		if (elo & TLBLO_VALID) {
-			continue;
-		}
-		ehi = faultaddress;
-		elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-		DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
-		tlb_write(ehi, elo, i);
-		splx(spl);
-		return 0;
+	vr = kmalloc(sizeof(struct vm_region));
+	if (vr == NULL) {
+		return ENOMEM;
 	}
+	vr->vr_base = vbase;
+	vr->vr_npages = npages;
+	vr->vr_perm = perm;
+	vr->vr_flags = 0;
+	vr->vr_vnode = NULL;
+	vr->vr_fvaddr = vbase;
+	vr->vr_foffset = 0;
+	vr->vr_filesize = 0;
+	vr->vr_next = NULL;
 
-	kprintf("dumbvm: Ran out of TLB entries - cannot handle page fault\n");
-	splx(spl);
-	return EFAULT;
+	*tailp = vr;
+	if (ret != NULL) {
+		*ret = vr;
+	}
+	return 0;
 }
 
 struct addrspace *
@@ -215,13 +1158,23 @@ as_create(void)
 		return NULL;
 	}
 
-	as->as_vbase1 = 0;
-	as->as_pbase1 = 0;
-	as->as_npages1 = 0;
-	as->as_vbase2 = 0;
-	as->as_pbase2 = 0;
-	as->as_npages2 = 0;
-	as->as_stackpbase = 0;
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	as->as_regions = NULL;
+	as->as_heap = NULL;
+	as->as_heapbrk = 0;
+	as->as_stack = NULL;
+	as->as_stacklimit = DUMBVM_STACKLIMIT;
+	as->as_stackmax = 0;
+	as->as_dying = false;
+	as->as_asid = 0;
+	as->as_asidgen = 0;
+	as->as_asidcpu = 0;
+	as->as_fanext = 0;
+	as->as_fawindow = 0;
 
 	return as;
 }
@@ -229,14 +1182,125 @@ as_create(void)
 void
 as_destroy(struct addrspace *as)
 {
+	struct vm_region *vr;
+	int result;
+
+	/*
+	 * Stop vm_evict from picking our pages; wait out any it has.
+	 * Nobody runs in AS any more, so its ASID can go too: what is
+	 * left in the TLB under it can't be used. Otherwise, if we
+	 * sleep below and wake up on another CPU, vm_tlbevict would
+	 * want to send a shootdown to the CPU the ASID is live on.
+	 */
+	spinlock_acquire(&evict_lock);
+	as->as_dying = true;
+	spinlock_release(&evict_lock);
+	spinlock_acquire(&vm_lock);
+	as->as_asidgen = 0;
+	spinlock_release(&vm_lock);
+
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		if (vr->vr_flags & VRF_SHARED && vr->vr_vnode != NULL) {
+			result = region_writeback(as, vr);
+			if (result) {
+				kprintf("dumbvm: writing back mapped file: %s\n",
+					strerror(result));
+			}
+		}
+	}
+
+	pt_destroy(as->as_pt);
+	while ((vr = as->as_regions) != NULL) {
+		as->as_regions = vr->vr_next;
+		if (vr->vr_vnode != NULL) {
+			VOP_DECREF(vr->vr_vnode);
+		}
+		kfree(vr);
+	}
 	kfree(as);
 }
 
+/*
+ * Invalidate every entry in this CPU's TLB.
+ */
+static
 void
-as_activate(void)
+vm_tlbflush(void)
+{
+	int i, spl;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	tlb_setasid(CURASID());
+	vmstats_inc(VMSTAT_TLB_INVALIDATE);
+
+	splx(spl);
+}
+
+/*
+ * Invalidate the entries in this CPU's TLB that belong to the active
+ * address space.
+ */
+static
+void
+vm_tlbflush_current(void)
 {
+	uint32_t ehi, elo, asid;
 	int i, spl;
+
+	spl = splhigh();
+
+	asid = CURASID();
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_read(&ehi, &elo, i);
+		if ((elo & TLBLO_VALID) &&
+		    (ehi & TLBHI_PID) >> TLBHI_PIDSHIFT == asid) {
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
+	}
+	tlb_setasid(asid);
+
+	splx(spl);
+}
+
+/*
+ * Called from interprocessor_interrupt, so at splhigh. The entry only
+ * matters if the address space still has a live ASID here; if it has
+ * moved on, anything left here is tagged with an ASID nobody uses.
+ * The address space can't go away under us: its PTE is busy until the
+ * sender hears we're done.
+ */
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	struct addrspace *as = ts->ts_addrspace;
+	unsigned cpunum = curcpu->c_number;
+
+	if (as->as_asidcpu == cpunum && as->as_asidgen != 0 &&
+	    as->as_asidgen == asidcpu[cpunum].ac_gen) {
+		vm_tlbinval(as, ts->ts_vaddr);
+	}
+}
+
+/*
+ * Too many shootdowns queued up at once to be worth doing one by one.
+ */
+void
+vm_tlbshootdown_all(void)
+{
+	vm_tlbflush();
+}
+
+void
+as_activate(void)
+{
 	struct addrspace *as;
+	unsigned cpunum;
+	int spl;
 
 	as = curproc_getas();
 #ifdef UW
@@ -246,12 +1310,32 @@ as_activate(void)
 		return;
 	}
 
-	/* Disable interrupts on this CPU while frobbing the TLB. */
 	spl = splhigh();
 
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	cpunum = curcpu->c_number;
+	if (as->as_asidcpu == cpunum && as->as_asidgen != 0 &&
+	    as->as_asidgen == asidcpu[cpunum].ac_gen) {
+		/* Our entries are still in the TLB. */
+		vmstats_inc(VMSTAT_TLB_ASID_REUSE);
 	}
+	else {
+		spinlock_acquire(&vm_lock);
+		if (asidcpu[cpunum].ac_gen == 0 ||
+		    asidcpu[cpunum].ac_next > ASID_MAX) {
+			/* Out of ASIDs; start a new generation. */
+			asidcpu[cpunum].ac_gen++;
+			asidcpu[cpunum].ac_next = ASID_MIN;
+			asidcpu[cpunum].ac_cpu = curcpu->c_self;
+			vm_tlbflush();
+			vmstats_inc(VMSTAT_TLB_ASID_ROLLOVER);
+		}
+		as->as_asid = asidcpu[cpunum].ac_next++;
+		as->as_asidgen = asidcpu[cpunum].ac_gen;
+		as->as_asidcpu = cpunum;
+		spinlock_release(&vm_lock);
+	}
+	asidcpu[cpunum].ac_cur = as->as_asid;
+	tlb_setasid(as->as_asid);
 
 	splx(spl);
 }
@@ -267,6 +1351,7 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 		 int readable, int writeable, int executable)
 {
 	size_t npages; 
+	unsigned perm;
 
 	/* Align the region. First, the base... */
 	sz += vaddr & ~(vaddr_t)PAGE_FRAME;
@@ -277,119 +1362,367 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 
 	npages = sz / PAGE_SIZE;
 
-	/* We don't use these - all pages are read-write */
-	(void)readable;
-	(void)writeable;
-	(void)executable;
-
-	if (as->as_vbase1 == 0) {
-		as->as_vbase1 = vaddr;
-		as->as_npages1 = npages;
-		return 0;
-	}
-
-	if (as->as_vbase2 == 0) {
-		as->as_vbase2 = vaddr;
-		as->as_npages2 = npages;
-		return 0;
-	}
-
 	/*
-	 * Support for more than two regions is not available.
+	 * Nothing is copied in through uiomove any more, so check
+	 * here that the executable isn't trying to load itself into
+	 * kernel space.
 	 */
-	kprintf("dumbvm: Warning: too many regions\n");
-	return EUNIMP;
-}
+	if (vaddr + sz > USERSPACETOP || vaddr + sz < vaddr) {
+		return EFAULT;
+	}
 
-static
-void
-as_zero_region(paddr_t paddr, unsigned npages)
-{
-	bzero((void *)PADDR_TO_KVADDR(paddr), npages * PAGE_SIZE);
+	perm = (readable ? VR_READ : 0) | (writeable ? VR_WRITE : 0) |
+		(executable ? VR_EXEC : 0);
+
+	return as_addregion(as, vaddr, npages, perm, NULL);
 }
 
 int
-as_prepare_load(struct addrspace *as)
+as_define_backing(struct addrspace *as, struct vnode *v, off_t offset,
+		  vaddr_t vaddr, size_t filesize)
 {
-	KASSERT(as->as_pbase1 == 0);
-	KASSERT(as->as_pbase2 == 0);
-	KASSERT(as->as_stackpbase == 0);
+	struct vm_region *vr;
 
-	as->as_pbase1 = getppages(as->as_npages1);
-	if (as->as_pbase1 == 0) {
-		return ENOMEM;
+	vr = as_findregion(as, vaddr);
+	if (vr == NULL || vr->vr_vnode != NULL) {
+		return EINVAL;
 	}
-
-	as->as_pbase2 = getppages(as->as_npages2);
-	if (as->as_pbase2 == 0) {
-		return ENOMEM;
+	if (vaddr + filesize > vr->vr_base + vr->vr_npages * PAGE_SIZE) {
+		return EINVAL;
 	}
 
-	as->as_stackpbase = getppages(DUMBVM_STACKPAGES);
-	if (as->as_stackpbase == 0) {
-		return ENOMEM;
-	}
-	
-	as_zero_region(as->as_pbase1, as->as_npages1);
-	as_zero_region(as->as_pbase2, as->as_npages2);
-	as_zero_region(as->as_stackpbase, DUMBVM_STACKPAGES);
+	VOP_INCREF(v);
+	vr->vr_vnode = v;
+	vr->vr_fvaddr = vaddr;
+	vr->vr_foffset = offset;
+	vr->vr_filesize = filesize;
+	return 0;
+}
 
+int
+as_prepare_load(struct addrspace *as)
+{
+	/* Pages are allocated and zeroed on demand in vm_fault. */
+	(void)as;
 	return 0;
 }
 
 int
 as_complete_load(struct addrspace *as)
 {
-	(void)as;
+	struct vm_region *vr;
+	vaddr_t heapbase;
+	int result;
+
+	/* The heap starts, empty, just past the last segment. */
+	heapbase = 0;
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		if (vr->vr_base + vr->vr_npages * PAGE_SIZE > heapbase) {
+			heapbase = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+		}
+	}
+	result = as_addregion(as, heapbase, 0, VR_READ | VR_WRITE,
+			      &as->as_heap);
+	if (result) {
+		return result;
+	}
+	as->as_heapbrk = heapbase;
 	return 0;
 }
 
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
-	KASSERT(as->as_stackpbase != 0);
+	int result;
+
+	result = as_addregion(as, USERSTACK - PAGE_SIZE, 1,
+			      VR_READ | VR_WRITE, &as->as_stack);
+	if (result) {
+		return result;
+	}
+	as->as_stackmax = 1;
 
 	*stackptr = USERSTACK;
 	return 0;
 }
 
+/*
+ * Map every page of the shared region VR of OLD into NEW, for as_copy.
+ * Each child of a fork has to see the same frames as its parent, so
+ * pages that aren't resident are brought in first, even the ones never
+ * touched; otherwise each would get its own copy when it touched them.
+ * That isn't a fault, so none of it is counted.
+ */
+static
+int
+region_share(struct addrspace *old, struct addrspace *new,
+	     struct vm_region *vr)
+{
+	vaddr_t va, top;
+	int how, result;
+
+	top = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+	for (va = vr->vr_base; va < top; va += PAGE_SIZE) {
+		while ((result = pt_share(old->as_pt, new->as_pt, va)) ==
+		       EAGAIN) {
+			result = vm_pagein(old, va, false, &how);
+			if (result) {
+				return result;
+			}
+		}
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *new;
+	struct vm_region *ovr, *nvr, **tailp;
+	int result;
 
 	new = as_create();
 	if (new==NULL) {
 		return ENOMEM;
 	}
 
-	new->as_vbase1 = old->as_vbase1;
-	new->as_npages1 = old->as_npages1;
-	new->as_vbase2 = old->as_vbase2;
-	new->as_npages2 = old->as_npages2;
+	new->as_heapbrk = old->as_heapbrk;
+	new->as_stacklimit = old->as_stacklimit;
+	new->as_stackmax = old->as_stackmax;
+	tailp = &new->as_regions;
+	for (ovr = old->as_regions; ovr != NULL; ovr = ovr->vr_next) {
+		nvr = kmalloc(sizeof(struct vm_region));
+		if (nvr == NULL) {
+			as_destroy(new);
+			return ENOMEM;
+		}
+		*nvr = *ovr;
+		nvr->vr_next = NULL;
+		if (ovr == old->as_heap) {
+			new->as_heap = nvr;
+		}
+		if (ovr == old->as_stack) {
+			new->as_stack = nvr;
+		}
+		if (nvr->vr_vnode != NULL) {
+			VOP_INCREF(nvr->vr_vnode);
+		}
+		*tailp = nvr;
+		tailp = &nvr->vr_next;
+	}
+
+	/*
+	 * Share every resident frame instead of copying it: those of
+	 * private writeable regions copy-on-write, those of shared
+	 * mappings outright. In private regions, pages never touched
+	 * stay on demand in the child too.
+	 */
+	for (ovr = old->as_regions; ovr != NULL; ovr = ovr->vr_next) {
+		if (ovr->vr_flags & VRF_SHARED) {
+			result = region_share(old, new, ovr);
+		}
+		else {
+			result = pt_copy(old->as_pt, new->as_pt, ovr->vr_base,
+					 ovr->vr_base + ovr->vr_npages * PAGE_SIZE,
+					 (ovr->vr_perm & VR_WRITE) != 0);
+		}
+		if (result) {
+			as_destroy(new);
+			return result;
+		}
+	}
+
+	/*
+	 * The old address space is the one we're running in, and the
+	 * TLB may still hold writeable mappings for pages that are now
+	 * copy-on-write. It can't have entries on any other CPU: those
+	 * are retired when it moves.
+	 */
+	if (old == curproc_getas()) {
+		vm_tlbflush_current();
+	}
+
+	*ret = new;
+	return 0;
+}
+
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbrk)
+{
+	struct vm_region *heap = as->as_heap;
+	vaddr_t newbrk, oldtop, newtop, va;
+	int spl;
+
+	KASSERT(heap != NULL);
+
+	newbrk = as->as_heapbrk + amount;
+	if (amount < 0 && newbrk > as->as_heapbrk) {
+		return EINVAL;
+	}
+	if (amount > 0 && newbrk < as->as_heapbrk) {
+		return ENOMEM;
+	}
+	if (newbrk < heap->vr_base) {
+		return EINVAL;
+	}
+
+	oldtop = heap->vr_base + heap->vr_npages * PAGE_SIZE;
+	newtop = ROUNDUP(newbrk, PAGE_SIZE);
+	if (newtop < newbrk || newtop > USERSPACETOP ||
+	    as_overlaps(as, heap->vr_base, newtop, heap)) {
+		return ENOMEM;
+	}
+	/* Leave the stack room to grow, and the guard gap. */
+	if (as->as_stack != NULL &&
+	    newtop + DUMBVM_STACKGUARD * PAGE_SIZE >
+	    USERSTACK - as->as_stacklimit) {
+		return ENOMEM;
+	}
+
+	/*
+	 * Growing only moves the end of the region; pages are
+	 * zero-filled as they are touched. Shrinking gives back the
+	 * frames and swap slots of the pages past the new end.
+	 */
+	heap->vr_npages = (newtop - heap->vr_base) / PAGE_SIZE;
+	for (va = newtop; va < oldtop; va += PAGE_SIZE) {
+		spl = splhigh();
+		vm_tlbevict(as, va, NULL);
+		splx(spl);
+		pt_unmap(as->as_pt, va);
+	}
+
+	*oldbrk = as->as_heapbrk;
+	as->as_heapbrk = newbrk;
+	return 0;
+}
+
+int
+as_mmap(struct addrspace *as, size_t len, unsigned perm, bool shared,
+	struct vnode *v, off_t offset, size_t filesize, vaddr_t *ret)
+{
+	struct vm_region *vr, *heap = as->as_heap;
+	vaddr_t top, base;
+	size_t npages;
+	int result;
 
-	/* (Mis)use as_prepare_load to allocate some physical memory. */
-	if (as_prepare_load(new)) {
-		as_destroy(new);
+	KASSERT(len > 0 && filesize <= len);
+	KASSERT(v != NULL || filesize == 0);
+	KASSERT(heap != NULL);
+
+	npages = DIVROUNDUP(len, PAGE_SIZE);
+	if (npages > (USERSTACK - as->as_stacklimit) / PAGE_SIZE) {
 		return ENOMEM;
 	}
 
-	KASSERT(new->as_pbase1 != 0);
-	KASSERT(new->as_pbase2 != 0);
-	KASSERT(new->as_stackpbase != 0);
+	/*
+	 * Take the highest gap that fits below where the stack may
+	 * grow to, leaving the guard gap, and above the heap.
+	 */
+	top = USERSTACK - as->as_stacklimit - DUMBVM_STACKGUARD * PAGE_SIZE;
+	while (1) {
+		if (top < npages * PAGE_SIZE) {
+			return ENOMEM;
+		}
+		base = top - npages * PAGE_SIZE;
+		if (base < heap->vr_base + heap->vr_npages * PAGE_SIZE) {
+			return ENOMEM;
+		}
+		vr = as_overlaps(as, base, top, NULL);
+		if (vr == NULL) {
+			break;
+		}
+		top = vr->vr_base;
+	}
+
+	result = as_addregion(as, base, npages, perm, &vr);
+	if (result) {
+		return result;
+	}
+	vr->vr_flags = VRF_MMAP | (shared ? VRF_SHARED : 0);
+	if (v != NULL) {
+		VOP_INCREF(v);
+		vr->vr_vnode = v;
+		vr->vr_fvaddr = base;
+		vr->vr_foffset = offset;
+		vr->vr_filesize = filesize;
+	}
+
+	*ret = base;
+	return 0;
+}
 
-	memmove((void *)PADDR_TO_KVADDR(new->as_pbase1),
-		(const void *)PADDR_TO_KVADDR(old->as_pbase1),
-		old->as_npages1*PAGE_SIZE);
+int
+as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	struct vm_region *vr, **vrp;
+	vaddr_t va;
+	int spl, result;
 
-	memmove((void *)PADDR_TO_KVADDR(new->as_pbase2),
-		(const void *)PADDR_TO_KVADDR(old->as_pbase2),
-		old->as_npages2*PAGE_SIZE);
+	for (vrp = &as->as_regions; *vrp != NULL; vrp = &(*vrp)->vr_next) {
+		if ((*vrp)->vr_base == vaddr) {
+			break;
+		}
+	}
+	vr = *vrp;
+	if (vr == NULL || !(vr->vr_flags & VRF_MMAP) ||
+	    vr->vr_npages != DIVROUNDUP(len, PAGE_SIZE)) {
+		/* Only whole mappings can be unmapped. */
+		return EINVAL;
+	}
 
-	memmove((void *)PADDR_TO_KVADDR(new->as_stackpbase),
-		(const void *)PADDR_TO_KVADDR(old->as_stackpbase),
-		DUMBVM_STACKPAGES*PAGE_SIZE);
-	
-	*ret = new;
+	if (vr->vr_flags & VRF_SHARED && vr->vr_vnode != NULL) {
+		result = region_writeback(as, vr);
+		if (result) {
+			return result;
+		}
+	}
+
+	*vrp = vr->vr_next;
+	for (va = vr->vr_base; va < vr->vr_base + vr->vr_npages * PAGE_SIZE;
+	     va += PAGE_SIZE) {
+		spl = splhigh();
+		vm_tlbevict(as, va, NULL);
+		splx(spl);
+		pt_unmap(as->as_pt, va);
+	}
+	if (vr->vr_vnode != NULL) {
+		VOP_DECREF(vr->vr_vnode);
+	}
+	kfree(vr);
+	return 0;
+}
+
+/*
+ * Each region is written back whole, even if only part of it is in
+ * the range; the rest just goes to the file sooner.
+ */
+int
+as_msync(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	struct vm_region *vr;
+	vaddr_t va, top;
+	int result;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	top = vaddr + ROUNDUP(len, PAGE_SIZE);
+	for (va = vaddr; va < top; va += vr->vr_npages * PAGE_SIZE) {
+		vr = as_findregion(as, va);
+		if (vr == NULL) {
+			return ENOMEM;
+		}
+		/* From the start of the region, so as to skip all of it. */
+		va = vr->vr_base;
+		if (vr->vr_flags & VRF_SHARED && vr->vr_vnode != NULL) {
+			result = region_writeback(as, vr);
+			if (result) {
+				return result;
+			}
+		}
+	}
 	return 0;
 }
@@ -55,7 +55,9 @@
  *
  * The c0_count register increments on every cycle; when the value
  * matches the c0_compare register, the timer interrupt line is
- * asserted. Writing to c0_compare again clears the interrupt.
+ * asserted and c0_count starts over from 0. Writing to c0_compare
+ * again clears the interrupt. So c0_count is always the number of
+ * cycles since the last timer interrupt.
  */
 static
 void
@@ -73,6 +75,22 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+static
+uint32_t
+mips_timer_get(void)
+{
+	uint32_t count;
+
+	/* $9 == c0_count */
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mfc0 %0, $9;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		: "=r" (count));
+	return count;
+}
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -116,6 +134,39 @@ mainbus_bootstrap(void)
 	mips_timer_set(CPU_FREQUENCY / HZ);
 }
 
+/*
+ * Program the on-chip timer of the current cpu to interrupt NTICKS
+ * hardclock periods after it last did. If that's already gone by, it
+ * interrupts at the end of the period in progress instead, because
+ * the count would otherwise have to wrap all the way around first.
+ */
+void
+mainbus_timer_set(unsigned nticks)
+{
+	uint32_t period, elapsed;
+
+	KASSERT(curthread->t_curspl > 0);
+	KASSERT(nticks > 0 && nticks <= 0xffffffff / (CPU_FREQUENCY / HZ));
+
+	period = CPU_FREQUENCY / HZ;
+	elapsed = mips_timer_get() / period;
+	if (nticks <= elapsed) {
+		nticks = elapsed + 1;
+	}
+	mips_timer_set(period * nticks);
+}
+
+/*
+ * Return the number of whole hardclock periods since the current
+ * cpu's last timer interrupt.
+ */
+unsigned
+mainbus_timer_elapsed(void)
+{
+	KASSERT(curthread->t_curspl > 0);
+	return mips_timer_get() / (CPU_FREQUENCY / HZ);
+}
+
 /*
  * Start all secondary CPUs.
  */
@@ -268,8 +319,12 @@ mainbus_interrupt(struct trapframe *tf)
 		lamebus_clear_ipi(lamebus, curcpu);
 	}
 	else if (cause & MIPS_TIMER_BIT) {
-		/* Reset the timer (this clears the interrupt) */
-		mips_timer_set(CPU_FREQUENCY / HZ);
+		/*
+		 * Reset the timer (this clears the interrupt) for as
+		 * many ticks as the last interval was; that's 1 unless
+		 * the cpu has stopped its tick.
+		 */
+		mips_timer_set(CPU_FREQUENCY / HZ * curcpu->c_tickspan);
 		/* and call hardclock */
 		hardclock();
 	}
@@ -842,8 +842,9 @@ static
 int
 emufs_mmap(struct vnode *v)
 {
+	/* Paged with VOP_READ and VOP_WRITE; nothing to set up. */
 	(void)v;
-	return EUNIMP;
+	return 0;
 }
 
 //////////////////////////////
@@ -1110,14 +1110,15 @@ sfs_fsync(struct vnode *v)
 }
 
 /*
- * Called for mmap().
+ * Called for mmap(). The VM system pages mapped files in and out
+ * with VOP_READ and VOP_WRITE, which is all we need.
  */
 static
 int
-sfs_mmap(struct vnode *v   /* add stuff as needed */)
+sfs_mmap(struct vnode *v)
 {
 	(void)v;
-	return EUNIMP;
+	return 0;
 }
 
 /*
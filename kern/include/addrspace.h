@@ -38,23 +38,74 @@
 #include <vm.h>
 
 struct vnode;
+struct pagetable;
 
 
+/*
+ * Region - a range of pages in an address space.
+ *
+ * Regions say which addresses are valid and where their contents come
+ * from; the page table says which pages have frames. Pages are given
+ * frames only when first touched (see vm_fault). The
+ * part of the region between vr_fvaddr and vr_fvaddr + vr_filesize
+ * is read from vr_vnode starting at file offset vr_foffset; the rest
+ * of the region is zero-filled.
+ *
+ * Regions made by mmap are marked VRF_MMAP. If they are also
+ * VRF_SHARED, pages that get written are marked dirty in the page
+ * table and written back to the file by msync, munmap and when the
+ * address space is destroyed. On fork, a shared region's frames are shared
+ * with the child; those of private writeable regions become
+ * copy-on-write.
+ */
+
+/* Region permissions; same values as the ELF PF_* flags */
+#define VR_EXEC   1
+#define VR_WRITE  2
+#define VR_READ   4
+
+/* Region flags */
+#define VRF_MMAP    1	/* made by mmap */
+#define VRF_SHARED  2	/* writes go back to vr_vnode */
+
+struct vm_region {
+	vaddr_t vr_base;		/* first page (page-aligned) */
+	size_t vr_npages;		/* length in pages */
+	unsigned vr_perm;		/* VR_READ | VR_WRITE | VR_EXEC */
+	unsigned vr_flags;		/* VRF_* */
+	struct vnode *vr_vnode;		/* backing file, or NULL */
+	vaddr_t vr_fvaddr;		/* where the file image begins */
+	off_t vr_foffset;		/* file offset of vr_fvaddr */
+	size_t vr_filesize;		/* bytes of file image */
+	struct vm_region *vr_next;	/* next region in the address space */
+};
+
 /* 
  * Address space - data structure associated with the virtual memory
  * space of a process.
  *
- * You write this.
+ * as_regions is a list of non-overlapping regions in the order they
+ * were defined: the ELF segments, the heap, then the stack. The heap
+ * region starts on the page after the last ELF segment and covers
+ * the pages up to the break, as_heapbrk, which sbrk moves. The stack
+ * region grows down from USERSTACK as it is used, up to
+ * as_stacklimit bytes.
  */
 
 struct addrspace {
-  vaddr_t as_vbase1;
-  paddr_t as_pbase1;
-  size_t as_npages1;
-  vaddr_t as_vbase2;
-  paddr_t as_pbase2;
-  size_t as_npages2;
-  paddr_t as_stackpbase;
+  struct vm_region *as_regions;
+  struct pagetable *as_pt;
+  struct vm_region *as_heap;	/* heap region, once loaded */
+  vaddr_t as_heapbrk;		/* current break */
+  struct vm_region *as_stack;	/* stack region, once defined */
+  size_t as_stacklimit;		/* most the stack may grow to, in bytes */
+  size_t as_stackmax;		/* most it has grown to, in pages */
+  bool as_dying;			/* being destroyed */
+  uint32_t as_asid;		/* TLB address space ID... */
+  uint32_t as_asidgen;		/* ...valid in this generation... */
+  unsigned as_asidcpu;		/* ...on this cpu */
+  vaddr_t as_fanext;		/* page after the last fault-around */
+  unsigned as_fawindow;		/* pages to fault around, 0 for none */
 };
 
 /*
@@ -82,6 +133,10 @@ struct addrspace {
  *    as_define_region - set up a region of memory within the address
  *                space.
  *
+ *    as_define_backing - arrange for the part of a region starting at
+ *                VADDR to be paged in on demand from FILESIZE bytes
+ *                of vnode V at file offset OFFSET.
+ *
  *    as_prepare_load - this is called before actually loading from an
  *                executable into the address space.
  *
@@ -91,6 +146,21 @@ struct addrspace {
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
+ *
+ *    as_sbrk   - move the heap break by AMOUNT bytes, handing back the
+ *                old break. Pages past the new break are freed.
+ *
+ *    as_mmap   - add a region of LEN bytes with permissions PERM
+ *                somewhere below the stack, and hand back its address.
+ *                Its first FILESIZE bytes come from vnode V at OFFSET;
+ *                the rest is zero. If SHARED, writes go back to V.
+ *
+ *    as_munmap - remove the mmap region of LEN bytes at VADDR, writing
+ *                back its dirty pages if it is shared.
+ *
+ *    as_msync  - write back the dirty pages of the shared file mappings
+ *                that overlap the LEN bytes at VADDR. ENOMEM if any of
+ *                those bytes are not mapped.
  */
 
 struct addrspace *as_create(void);
@@ -104,9 +174,19 @@ int               as_define_region(struct addrspace *as,
                                    int readable, 
                                    int writeable,
                                    int executable);
+int               as_define_backing(struct addrspace *as,
+                                    struct vnode *v, off_t offset,
+                                    vaddr_t vaddr, size_t filesize);
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *oldbrk);
+int               as_mmap(struct addrspace *as, size_t len, unsigned perm,
+                          bool shared, struct vnode *v, off_t offset,
+                          size_t filesize, vaddr_t *ret);
+int               as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len);
+int               as_msync(struct addrspace *as, vaddr_t vaddr, size_t len);
 
 
 /*
@@ -36,7 +36,11 @@
  * Time-related definitions.
  *
  * hardclock() is called on every CPU HZ times a second, possibly only
- * when the CPU is not idle, for scheduling.
+ * when the CPU is not idle, for scheduling. A CPU with nothing for it
+ * to do can call hardclock_stop() to skip the interrupts for a while;
+ * the next hardclock() then counts all the ticks that went by.
+ * hardclock_start() goes back to one interrupt per tick. Both must be
+ * called with interrupts off.
  *
  * timerclock() is called on one CPU once a second to allow simple
  * timed operations. (This is a fairly simpleminded interface.)
@@ -59,6 +63,8 @@
 void hardclock_bootstrap(void);
 
 void hardclock(void);
+void hardclock_stop(void);
+void hardclock_start(void);
 void timerclock(void);
 
 void gettime(time_t *seconds, uint32_t *nanoseconds);
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+/*
+ * Coremap: accounting for physical page frames.
+ *
+ * There is one entry for every physical page in the range handed to
+ * the VM system by ram_getsize(). Each entry records whether the
+ * frame is free, owned by the kernel heap, or owned by a user address
+ * space, and the first frame of each allocation records how many
+ * frames long the allocation is, so a free only needs the address,
+ * and how many references there are to it.
+ *
+ * Before coremap_bootstrap() is called, allocations are satisfied
+ * with ram_stealmem() and can never be given back; frees of such
+ * pages are silently ignored.
+ *
+ *    coremap_bootstrap - take over physical memory from ram.c. Called
+ *                        from vm_bootstrap.
+ *
+ *    coremap_alloc     - allocate NPAGES physically contiguous frames
+ *                        for OWNER (CM_KERNEL or CM_USER). Returns 0
+ *                        if there is no free block big enough.
+ *
+ *    coremap_alloczero - allocate one frame for OWNER, filled with
+ *                        zeroes. Comes from the pool of frames zeroed
+ *                        ahead of time if it can. Returns 0 if there
+ *                        are no free frames.
+ *
+ *    coremap_free      - drop a reference to an allocation made by
+ *                        coremap_alloc, given the physical address of
+ *                        its first frame. The frames are released when
+ *                        the last reference goes away.
+ *
+ *    coremap_incref    - add a reference to an allocation, for sharing
+ *                        it (e.g. copy-on-write after fork).
+ *
+ *    coremap_refcount  - return the number of references to an
+ *                        allocation. Only meaningful to a caller that
+ *                        holds one of them.
+ *
+ *    coremap_setowner  - record that the user page PADDR is mapped only
+ *                        at VADDR in AS, which makes it eligible to be
+ *                        paged out. Sharing the page (coremap_incref)
+ *                        or freeing it forgets this.
+ *
+ *    coremap_touch     - note that the page PADDR is in use.
+ *
+ *    coremap_victim    - pick a page to be paged out, among those with
+ *                        an owner for which OK returns true. The page
+ *                        is marked busy and its owner handed back.
+ *                        Returns ENOMEM if there are no candidates.
+ *
+ *    coremap_isbusy    - true if PADDR has been picked by coremap_victim
+ *                        and not yet put back or reclaimed.
+ *
+ *    coremap_unbusy    - put back a page coremap_victim picked, after
+ *                        failing to page it out.
+ *
+ *    coremap_reclaim   - hand over a page that has been paged out to a
+ *                        new OWNER, as if just allocated.
+ *
+ *    coremap_setheap   - remember HEAP, the kernel heap's own record of
+ *                        the kernel page PADDR, for coremap_heap. Frames
+ *                        start out with NULL every time they're allocated.
+ *                        Pages stolen before the coremap was set up are
+ *                        ignored, as by coremap_free.
+ *
+ *    coremap_heap      - return what coremap_setheap recorded for the
+ *                        page PADDR, or NULL if it isn't a frame the
+ *                        coremap manages.
+ *
+ *    coremap_prezero   - zero one free frame for the coremap_alloczero
+ *                        pool, if the pool wants refilling. Called by
+ *                        idle CPUs. Returns true if it did anything.
+ *
+ *    coremap_printstats - print frame usage counts, free blocks of each
+ *                        size, and how fragmented free memory is.
+ */
+
+struct addrspace;
+
+/* Frame owners */
+#define CM_FREE      0
+#define CM_KERNEL    1
+#define CM_USER      2
+
+void coremap_bootstrap(void);
+paddr_t coremap_alloc(unsigned long npages, int owner);
+paddr_t coremap_alloczero(int owner);
+void coremap_free(paddr_t paddr);
+void coremap_incref(paddr_t paddr);
+unsigned coremap_refcount(paddr_t paddr);
+void coremap_setowner(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+void coremap_touch(paddr_t paddr);
+int coremap_victim(bool (*ok)(struct addrspace *),
+		   paddr_t *paddr, struct addrspace **as, vaddr_t *vaddr);
+bool coremap_isbusy(paddr_t paddr);
+void coremap_unbusy(paddr_t paddr);
+void coremap_reclaim(paddr_t paddr, int owner);
+void coremap_setheap(paddr_t paddr, void *heap);
+void *coremap_heap(paddr_t paddr);
+bool coremap_prezero(void);
+void coremap_printstats(void);
+
+#endif /* _COREMAP_H_ */
@@ -33,6 +33,7 @@
 
 #include <spinlock.h>
 #include <threadlist.h>
+#include <cpustat.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
 
@@ -60,12 +61,17 @@ struct cpu {
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	unsigned c_lastboost;		/* c_hardclocks at last priority boost */
+	uint32_t c_stealseed;		/* Random state for thread_steal */
+	unsigned c_tickspan;		/* Hardclocks per timer interrupt */
+	uint32_t c_stats[CPUSTAT_COUNT];	/* Event counters (cpustat.h) */
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
+	bool c_tickless;		/* True if running alone, tick off */
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
 	struct spinlock c_runqueue_lock;
 
@@ -81,11 +87,20 @@ struct cpu {
 	 *
 	 * struct tlbshootdown is machine-dependent and might
 	 * reasonably be either an address space and vaddr pair, or a
-	 * paddr, or something else.
+	 * paddr, or something else. TLBSHOOTDOWN_SAME (also MD) says
+	 * whether two of them do the same thing, so that a request
+	 * already queued isn't queued again.
+	 *
+	 * Each shootdown request gets a ticket from c_shootdown_posted;
+	 * once the CPU has handled its queue it sets c_shootdown_done
+	 * to the last ticket handed out, so a sender can wait for its
+	 * request to be done.
 	 */
 	uint32_t c_ipi_pending;		/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	int c_numshootdown;
+	unsigned c_shootdown_posted;	/* Last ticket handed out */
+	volatile unsigned c_shootdown_done;	/* Last ticket handled */
 	struct spinlock c_ipi_lock;
 };
 
@@ -152,6 +167,10 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * It returns a ticket for the request, which can be passed to
+ * ipi_tlbshootdown_wait to wait until the target has done it. Since
+ * the target has to take an interrupt for that, the waiter must not
+ * hold a spinlock or be at splhigh.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -165,7 +184,9 @@ void cpu_halt(void);
 
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
-void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+unsigned ipi_tlbshootdown(struct cpu *target,
+			  const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_wait(struct cpu *target, unsigned ticket);
 
 void interprocessor_interrupt(void);
 
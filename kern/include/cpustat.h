@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _CPUSTAT_H_
+#define _CPUSTAT_H_
+
+/*
+ * Per-cpu event counters.
+ *
+ * Every cpu has its own array of counters in struct cpu, so counting
+ * an event only touches the memory of the cpu it happened on and
+ * takes no lock. Interrupts are held off just for the increment,
+ * since interrupt handlers count things too and the thread must not
+ * move to another cpu halfway through. Reading a counter adds it up
+ * over all cpus; that's unlocked, so the total is only as exact as a
+ * snapshot taken while other cpus are counting can be.
+ *
+ * The first VMSTAT_COUNT counters are the ones uw-vmstats reports.
+ *
+ *    cpustat_inc   - count one event of kind WHICH on this cpu.
+ *
+ *    cpustat_add   - count AMOUNT events of kind WHICH on this cpu.
+ *
+ *    cpustat_get   - total of counter WHICH over all cpus.
+ *
+ *    cpustat_reset - zero counter WHICH on all cpus.
+ *
+ *    cpustat_print - print the counters that aren't vmstats, for each
+ *                    cpu and in total.
+ */
+
+#include <uw-vmstats.h>
+
+#define CPUSTAT_VM        0	/* through VMSTAT_COUNT-1: vmstats */
+#define CPUSTAT_SWITCH    (VMSTAT_COUNT + 0)	/* context switches */
+#define CPUSTAT_MIGRATE   (VMSTAT_COUNT + 1)	/* threads sent elsewhere */
+#define CPUSTAT_IDLE      (VMSTAT_COUNT + 2)	/* times gone idle */
+#define CPUSTAT_KMALLOC   (VMSTAT_COUNT + 3)	/* kmalloc calls */
+#define CPUSTAT_KFREE     (VMSTAT_COUNT + 4)	/* kfree calls */
+#define CPUSTAT_SYSCALL   (VMSTAT_COUNT + 5)	/* system calls */
+#define CPUSTAT_KMAGHIT   (VMSTAT_COUNT + 6)	/* kmalloc magazine hits */
+#define CPUSTAT_KMAGMISS  (VMSTAT_COUNT + 7)	/* ...and misses */
+#define CPUSTAT_STEAL     (VMSTAT_COUNT + 8)	/* threads stolen when idle */
+#define CPUSTAT_CLOCKINT  (VMSTAT_COUNT + 9)	/* timer interrupts taken */
+#define CPUSTAT_TICKSKIP  (VMSTAT_COUNT + 10)	/* hardclocks without one */
+#define CPUSTAT_COUNT     (VMSTAT_COUNT + 11)
+
+void cpustat_inc(unsigned which);
+void cpustat_add(unsigned which, uint32_t amount);
+uint32_t cpustat_get(unsigned which);
+void cpustat_reset(unsigned which);
+void cpustat_print(void);
+
+#endif /* _CPUSTAT_H_ */
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Definitions for mmap(), munmap() and msync().
+ */
+
+
+/* Page protections for mmap(). */
+#define PROT_NONE    0
+#define PROT_READ    1		/* Pages can be read. */
+#define PROT_WRITE   2		/* Pages can be written. */
+#define PROT_EXEC    4		/* Pages can be executed. */
+
+/* Flags for mmap(). Exactly one of MAP_SHARED and MAP_PRIVATE. */
+#define MAP_SHARED   0x0001	/* Writes go back to the file. */
+#define MAP_PRIVATE  0x0002	/* Writes are seen only by this process. */
+#define MAP_ANON     0x1000	/* No file; pages start out zero. */
+
+/* mmap() return value on error. */
+#define MAP_FAILED   ((void *)-1)
+
+/* Flags for msync(). Not both MS_ASYNC and MS_SYNC. */
+#define MS_ASYNC       0x0001	/* Start writing back (writes anyway). */
+#define MS_SYNC        0x0002	/* Write back before returning. */
+#define MS_INVALIDATE  0x0004	/* Drop other cached copies. */
+
+
+#endif /* _KERN_MMAN_H_ */
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KPROF_H_
+#define _KPROF_H_
+
+/*
+ * Kernel heap profiler.
+ *
+ * While it is turned on, every kmalloc is recorded in a table on the
+ * side, along with where it was called from: the return address, and
+ * the source file, whose directory stands for the subsystem. Every
+ * kfree of a recorded block takes it out again. For each call site
+ * this keeps the bytes it has live, the most it has had live, and how
+ * many allocations it has made.
+ *
+ * Blocks are also stamped with a generation number. Starting a new
+ * generation and later asking which blocks from the one before are
+ * still allocated finds leaks: anything that should have been freed
+ * by the time a test or a program finished shows up.
+ *
+ * It's off by default, when all kmalloc and kfree pay for it is a
+ * test of kprof_on. Blocks allocated while it was off are never seen.
+ * The table has room for a fixed number of live blocks; allocations
+ * past that aren't tracked, but are counted.
+ *
+ *    kprof_start   - turn profiling on with empty tables. Returns
+ *                    ENOMEM if there's no memory for them, EBUSY if
+ *                    it is already on.
+ *
+ *    kprof_stop    - turn profiling off and throw the tables away.
+ *
+ *    kprof_alloc   - record that PTR, SIZE bytes, was allocated by a
+ *                    call at PC in FILE. Called by kmalloc.
+ *
+ *    kprof_free    - record that PTR was freed. Called by kfree.
+ *
+ *    kprof_nextgen - start a new generation.
+ *
+ *    kprof_print   - print the call sites with the most bytes live,
+ *                    with their peak and allocation rate, and the live
+ *                    bytes of each subsystem.
+ *
+ *    kprof_leaks   - print, by call site, the blocks allocated in the
+ *                    previous generation that are still allocated.
+ */
+
+extern volatile bool kprof_on;
+
+int kprof_start(void);
+void kprof_stop(void);
+void kprof_alloc(void *ptr, size_t size, vaddr_t pc, const char *file);
+void kprof_free(void *ptr);
+void kprof_nextgen(void);
+void kprof_print(void);
+void kprof_leaks(void);
+
+#endif /* _KPROF_H_ */
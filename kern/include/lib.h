@@ -122,11 +122,21 @@ uint32_t random(void);
 /*
  * Kernel heap memory allocation. Like malloc/free.
  * If out of memory, kmalloc returns NULL.
+ *
+ * kmalloc passes on the source file it's called from, for the heap
+ * profiler (see kprof.h).
  */
-void *kmalloc(size_t size);
+void *kmalloc_at(size_t size, const char *file);
+#define kmalloc(size) kmalloc_at(size, __FILE__)
 void kfree(void *ptr);
 void kheap_printstats(void);
 
+/*
+ * Send the free blocks cached in every cpu's kmalloc magazines back
+ * to their pages, and return the number of pages that freed.
+ */
+unsigned kheap_drain(void);
+
 /*
  * C string functions. 
  *
@@ -55,6 +55,16 @@ size_t mainbus_ramsize(void);
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
+/*
+ * Per-cpu hardclock timer. (Low-level; see hardclock_stop.)
+ * mainbus_timer_set makes the current cpu's next timer interrupt
+ * come NTICKS periods of 1/HZ after its last one, or at the end of
+ * the current period if that's later. mainbus_timer_elapsed returns
+ * the number of whole periods since the last one.
+ */
+void mainbus_timer_set(unsigned nticks);
+unsigned mainbus_timer_elapsed(void);
+
 /*
  * The various ways to shut down the system. (These are very low-level
  * and should generally not be called directly - md_poweroff, for
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PAGECACHE_H_
+#define _PAGECACHE_H_
+
+/*
+ * Page cache for read-only file pages, so that every process running
+ * the same program maps the same frames for its text instead of each
+ * reading its own copy.
+ *
+ * A page is named by the vnode it comes from, the file offset of its
+ * first byte (which may be before FSTART), and the range [FSTART,
+ * FEND) of the file that the mapping covers; bytes of the page
+ * outside that range are zero. The cache holds a reference to each
+ * frame it knows about (so the frame is shared, and never paged out)
+ * and to the vnode.
+ *
+ *    pagecache_bootstrap - set up the cache. Called from vm_bootstrap.
+ *
+ *    pagecache_lookup  - return the frame holding the named page, with
+ *                        a new reference to it for the caller, or 0 if
+ *                        it isn't cached.
+ *
+ *    pagecache_insert  - offer the freshly filled frame PADDR, in which
+ *                        the caller holds the only reference, as the
+ *                        named page. Returns the frame the caller
+ *                        should map: PADDR, now also referenced by the
+ *                        cache, or, if someone else got there first,
+ *                        their frame (with a reference for the caller,
+ *                        having dropped PADDR).
+ *
+ *    pagecache_invalidate - forget every page of V, e.g. after V has
+ *                        been written. Frames still mapped keep their
+ *                        old contents.
+ *
+ *    pagecache_flush   - forget every page, dropping the cache's vnode
+ *                        references so that filesystems can be
+ *                        unmounted. May sleep.
+ *
+ *    pagecache_reclaim - drop the pages nobody but the cache is using,
+ *                        to free memory. Returns the number of frames
+ *                        freed. May sleep.
+ *
+ *    pagecache_printstats - print hit, miss and size counts.
+ */
+
+struct vnode;
+
+void pagecache_bootstrap(void);
+paddr_t pagecache_lookup(struct vnode *v, off_t offset,
+			 off_t fstart, off_t fend);
+paddr_t pagecache_insert(struct vnode *v, off_t offset,
+			 off_t fstart, off_t fend, paddr_t paddr);
+void pagecache_invalidate(struct vnode *v);
+void pagecache_flush(void);
+unsigned pagecache_reclaim(void);
+void pagecache_printstats(void);
+
+#endif /* _PAGECACHE_H_ */
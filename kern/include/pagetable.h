@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+/*
+ * Two-level page table for user address spaces.
+ *
+ * The top 10 bits of a virtual address index the directory, the next
+ * 10 the second-level table, which is exactly one page of PTEs. Only
+ * the user part of the address space (below USERSPACETOP) is covered,
+ * and second-level tables are allocated only for the 4M chunks of
+ * address space that have pages in them, so a sparse address space
+ * costs memory in proportion to what is actually touched.
+ *
+ * A PTE holds the physical frame (or, for a page that has been
+ * swapped out, the swap slot) in its upper bits and per-page state in
+ * the low bits; a PTE of 0 means the page has never been touched.
+ *
+ * While a page is being evicted its PTE is marked PTE_BUSY; anyone
+ * else who needs it waits in pt_waitbusy until the evictor calls
+ * pt_setentry with the final value.
+ *
+ * The evictor may be on another CPU from the one the owner is running
+ * on, so changes to the entry of a resident page are made holding
+ * pt_lock, which is also what the evictor holds to mark it busy. The
+ * owner can still read its own entries without it.
+ *
+ *    pt_bootstrap - set up the wait channel for busy PTEs.
+ *
+ *    pt_create  - create an empty page table. Returns NULL if out of
+ *                 memory.
+ *
+ *    pt_destroy - destroy a page table, dropping its reference to
+ *                 every frame it maps and freeing its swap slots.
+ *
+ *    pt_lookup  - return a pointer to the PTE for VADDR. If there is
+ *                 no second-level table for it, returns NULL, unless
+ *                 CREATE is set, in which case one is allocated (and
+ *                 NULL means out of memory).
+ *
+ *    pt_copy    - copy the mappings of OLD from START to END into
+ *                 NEW, where there are none yet, for fork. Frames
+ *                 are shared rather than copied, and if COW, become
+ *                 copy-on-write in both. Pages that are swapped out
+ *                 get a copy in a new swap slot.
+ *
+ *    pt_share   - map the frame OLD has at VADDR in NEW too, for a
+ *                 shared mapping, so that writes through either are
+ *                 seen by both. Returns EAGAIN if the page isn't
+ *                 resident in OLD.
+ *
+ *    pt_unmap   - forget the page at VADDR, freeing its frame or swap
+ *                 slot. The caller takes care of the TLB.
+ *
+ *    pt_waitbusy - wait until *PTE is no longer busy.
+ *
+ *    pt_setentry - set the busy entry *PTE to VAL and wake up anyone
+ *                 waiting for it.
+ */
+
+#include <spinlock.h>
+
+typedef uint32_t pte_t;
+
+#define PTE_FRAME   0xfffff000	/* physical frame number */
+#define PTE_VALID   0x00000001	/* page has a frame */
+#define PTE_WRITE   0x00000002	/* page may be written now */
+#define PTE_COW     0x00000004	/* frame shared copy-on-write */
+#define PTE_SWAPPED 0x00000008	/* page is in swap slot PTE_SLOT */
+#define PTE_BUSY    0x00000010	/* page is being evicted */
+#define PTE_DIRTY   0x00000020	/* shared file page needs writing back */
+
+#define PTE_SLOT(pte)     ((pte) >> 12)
+#define PTE_MKSWAP(slot)  (((slot) << 12) | PTE_SWAPPED)
+
+#define PT_L1SHIFT   22
+#define PT_L2SHIFT   12
+#define PT_L2ENTRIES 1024
+#define PT_L1ENTRIES (USERSPACETOP >> PT_L1SHIFT)
+
+struct pagetable {
+	struct spinlock pt_lock;	/* for changing resident entries */
+	pte_t *pt_dir[PT_L1ENTRIES];
+};
+
+void pt_bootstrap(void);
+struct pagetable *pt_create(void);
+void pt_destroy(struct pagetable *pt);
+pte_t *pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create);
+int pt_copy(struct pagetable *old, struct pagetable *new,
+	    vaddr_t start, vaddr_t end, bool cow);
+int pt_share(struct pagetable *old, struct pagetable *new, vaddr_t vaddr);
+void pt_unmap(struct pagetable *pt, vaddr_t vaddr);
+void pt_waitbusy(pte_t *pte);
+void pt_setentry(pte_t *pte, pte_t val);
+
+#endif /* _PAGETABLE_H_ */
@@ -103,6 +103,14 @@ struct proc {
   struct vnode *console;                /* a vnode for the console device */
 #endif
 
+	/*
+	 * Files opened with open(), by descriptor. Descriptors 0-2 are
+	 * the console and are never in here. No lock: only the
+	 * process's own (single) thread touches this.
+	 */
+	struct vnode *p_files[OPEN_MAX];
+	int p_fileflags[OPEN_MAX];	/* open() flags */
+
 	/* add more material here as needed */
 };
 
@@ -132,6 +140,15 @@ int waitpid_interested_error(const int pid);
 // Semi destroys the process
 void proc_semi_destroy(struct proc *proc);
 
+// Closes every file the process has open
+void proc_closefiles(struct proc *proc);
+
+// Gives the process to references to the files the process from has open
+void proc_dupfiles(struct proc *from, struct proc *to);
+
+// Removes child from the children of proc, when it never got to run
+void proc_forget_child(struct proc *proc, struct proc *child);
+
 
 /* Semaphore used to signal when there are no more processes */
 #ifdef UW
@@ -147,6 +164,10 @@ struct proc *proc_create_runprogram(const char *name);
 // Creates a forked process of the given process proc
 struct proc *proc_fork(struct proc * proc);
 
+// Creates a child of proc with its open files but no address space,
+// for a new program to be loaded into
+struct proc *proc_spawn(struct proc * proc, const char * name);
+
 /* Destroy a process. */
 void proc_destroy(struct proc *proc);
 
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space: page-sized slots on a raw disk device (SWAP_DEVICE),
+ * with a bitmap of which slots are in use. If the device isn't there
+ * the system runs without swap and swap_enabled() says so.
+ *
+ *    swap_bootstrap - open the swap device. Called from vm_bootstrap.
+ *
+ *    swap_enabled   - true if there is a swap device.
+ *
+ *    swap_alloc     - allocate a slot. Returns ENOSPC if swap is full.
+ *
+ *    swap_free      - release a slot.
+ *
+ *    swap_dup       - allocate a new slot holding a copy of SLOT.
+ *
+ *    swap_in        - read SLOT into the frame PADDR. Not counted in
+ *                     the vmstats; the page fault handler does that.
+ *
+ *    swap_out       - write the frame PADDR to SLOT.
+ *
+ *    swap_printstats - print slot usage counts.
+ *
+ * swap_in, swap_out and swap_dup sleep, so they may not be called
+ * while holding a spinlock.
+ */
+
+#define SWAP_DEVICE  "lhd1raw:"
+
+void swap_bootstrap(void);
+bool swap_enabled(void);
+int swap_alloc(uint32_t *slot);
+void swap_free(uint32_t slot);
+int swap_dup(uint32_t slot, uint32_t *newslot);
+int swap_in(uint32_t slot, paddr_t paddr);
+int swap_out(paddr_t paddr, uint32_t slot);
+void swap_printstats(void);
+
+#endif /* _SWAP_H_ */
@@ -65,6 +65,14 @@ int sys_getpid(pid_t *retval);
 int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval);
 int sys_fork(struct trapframe * tf, pid_t *retval);
 int sys_execv(userptr_t progname, userptr_t args);
+int sys_spawn(userptr_t progname, userptr_t args, pid_t *retval);
+int sys_sbrk(intptr_t amount, vaddr_t *retval);
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+	     off_t offset, vaddr_t *retval);
+int sys_munmap(userptr_t addr, size_t len);
+int sys_msync(userptr_t addr, size_t len, int flags);
+int sys_open(userptr_t path, int flags, int *retval);
+int sys_close(int fdesc);
 #endif // UW
 
 #endif /* _SYSCALL_H_ */
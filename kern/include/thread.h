@@ -84,6 +84,19 @@ struct thread {
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
 
+	/*
+	 * Scheduler fields.
+	 *
+	 * t_prio is the thread's level in the multi-level feedback
+	 * queue, 0 being the highest; t_quantum is how many more
+	 * hardclocks it gets at that level before it is moved down one.
+	 * They're changed by the cpu the thread is on, under its run
+	 * queue lock or while running it, and by whoever wakes it up.
+	 */
+	unsigned t_prio;		/* Scheduling level */
+	unsigned t_quantum;		/* Hardclocks left at this level */
+	unsigned t_lastran;		/* t_cpu's c_hardclocks when it stopped */
+
 	/*
 	 * Interrupt state fields.
 	 *
@@ -162,6 +175,14 @@ void thread_yield(void);
  */
 void schedule(void);
 
+/*
+ * Charge a hardclock to the current thread, and yield if it has used
+ * up its quantum or something more important is waiting. If nothing
+ * is waiting at all, stops the cpu's tick instead. Called from the
+ * timer interrupt.
+ */
+void thread_timeslice(void);
+
 /*
  * Potentially migrate ready threads to other CPUs. Called from the
  * timer interrupt.
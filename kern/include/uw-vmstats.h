@@ -9,12 +9,11 @@
 /* Virtual memory stats */
 /* Tracks stats on user programs */
 
-/* NOTE !!!!!! WARNING !!!!!
- * All of the functions (except vmstats_print) whose names begin with '_'
- * assume that atomicity is ensured elsewhere
- * (i.e., outside of these routines) by acquiring stats_lock.
- * All of the functions whose names do not begin
- * with '_' ensure atomicity locally (except vmstats_print).
+/* NOTE: The counts are kept per-cpu in struct cpu (see cpustat.h),
+ * so vmstats_inc takes no lock and is cheap enough for the TLB
+ * fault path. The functions whose names begin with '_' used to
+ * assume the caller held a global stats_lock; there is no such lock
+ * any more and they are the same as the ones without the '_'.
  *
  * Generally you will use the functions whose names
  * do not begin with '_'.
@@ -36,21 +35,26 @@
 #define VMSTAT_ELF_FILE_READ          (7)
 #define VMSTAT_SWAP_FILE_READ         (8)
 #define VMSTAT_SWAP_FILE_WRITE        (9)
-#define VMSTAT_COUNT                 (10)
+#define VMSTAT_TLB_ASID_REUSE        (10)
+#define VMSTAT_TLB_ASID_ROLLOVER     (11)
+#define VMSTAT_TLB_SHOOTDOWN         (12)
+#define VMSTAT_TLB_FAULTAROUND       (13)
+#define VMSTAT_MMAP_FILE_READ        (14)
+#define VMSTAT_COUNT                 (15)
 
 /* ----------------------------------------------------------------------- */
 
 /* Initialize the statistics: must be called before using */
-void vmstats_init(void);                     /* uses locking */
-void _vmstats_init(void);                    /* atomicity must be ensured elsewhere */
+void vmstats_init(void);
+void _vmstats_init(void);
 
 /* Increment the specified count 
  * Example use: 
  *   vmstats_inc(VMSTAT_TLB_FAULT);
  *   vmstats_inc(VMSTAT_PAGE_FAULT_ZERO);
  */
-void vmstats_inc(unsigned int index);    /* uses locking */
-void _vmstats_inc(unsigned int index);   /* atomicity must be ensured elsewhere */
+void vmstats_inc(unsigned int index);
+void _vmstats_inc(unsigned int index);
 
 /* Print the statistics: assumes that at least vmstats_init has been called */
 void vmstats_print(void);                    /* Does NOT use locking */
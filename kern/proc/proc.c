@@ -157,6 +157,11 @@ proc_create(const char *name)
 	proc->console = NULL;
 #endif // UW
 
+	for (int i = 0; i < OPEN_MAX; i++) {
+		proc->p_files[i] = NULL;
+		proc->p_fileflags[i] = 0;
+	}
+
 	return proc;
 }
 
@@ -216,6 +221,7 @@ proc_destroy(struct proc *proc)
 	  vfs_close(proc->console);
 	}
 #endif // UW
+	proc_closefiles(proc);
 
 	threadarray_cleanup(&proc->p_threads);
 	spinlock_cleanup(&proc->p_lock);
@@ -540,9 +546,56 @@ struct proc * proc_fork(struct proc * proc){
 	}
 	// Set the childs address space
 	child_proc->p_addrspace = child_as;
+	proc_dupfiles(proc, child_proc);
+	return child_proc;
+}
+
+struct proc * proc_spawn(struct proc * proc, const char * name){
+	struct proc *child_proc;
+	if (proc == NULL) {
+		return NULL;
+	}
+	child_proc = proc_create_runprogram(name);
+	if (child_proc == NULL) {
+		return NULL;
+	}
+	// No address space; the child loads its program into a new one
+	proc_dupfiles(proc, child_proc);
 	return child_proc;
 }
 
+void proc_dupfiles(struct proc *from, struct proc *to) {
+	// The child shares the parent's open files
+	for (int i = 0; i < OPEN_MAX; i++) {
+		if (from->p_files[i] != NULL) {
+			VOP_INCREF(from->p_files[i]);
+			to->p_files[i] = from->p_files[i];
+			to->p_fileflags[i] = from->p_fileflags[i];
+		}
+	}
+}
+
+void proc_forget_child(struct proc *proc, struct proc *child) {
+	lock_acquire(proc->proc_children_lock);
+	int num_children = procarray_num(&proc->proc_children);
+	for (int i = 0; i < num_children; i++) {
+		if (procarray_get(&proc->proc_children, i) == child) {
+			procarray_remove(&proc->proc_children, i);
+			break;
+		}
+	}
+	lock_release(proc->proc_children_lock);
+}
+
+void proc_closefiles(struct proc *proc) {
+	for (int i = 0; i < OPEN_MAX; i++) {
+		if (proc->p_files[i] != NULL) {
+			vfs_close(proc->p_files[i]);
+			proc->p_files[i] = NULL;
+		}
+	}
+}
+
 /*
  * Add a thread to a process. Either the thread or the process might
  * or might not be current.
@@ -45,10 +45,12 @@
 #include <vm.h>
 #include <mainbus.h>
 #include <vfs.h>
+#include <pagecache.h>
 #include <device.h>
 #include <syscall.h>
 #include <test.h>
 #include <version.h>
+#include <uw-vmstats.h>
 #include "autoconf.h"  // for pseudoconfig
 
 
@@ -146,9 +148,13 @@ shutdown(void)
 {
 
 	kprintf("Shutting down.\n");
+
+	vmstats_print();
 	
 	vfs_clearbootfs();
 	vfs_clearcurdir();
+	/* The page cache holds vnodes open, which would keep them busy. */
+	pagecache_flush();
 	vfs_unmountall();
 
 	thread_shutdown();
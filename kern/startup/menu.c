@@ -35,10 +35,13 @@
 #include <lib.h>
 #include <uio.h>
 #include <clock.h>
+#include <cpustat.h>
+#include <kprof.h>
 #include <thread.h>
 #include <proc.h>
 #include <synch.h>
 #include <vfs.h>
+#include <pagecache.h>
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
@@ -354,6 +357,8 @@ cmd_unmount(int nargs, char **args)
 		device[strlen(device)-1] = 0;
 	}
 
+	/* Cached pages hold their vnodes, and so the fs, busy. */
+	pagecache_flush();
 	return vfs_unmount(device);
 }
 
@@ -398,6 +403,50 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+/*
+ * Command for the heap profiler.
+ */
+static
+int
+cmd_kprof(int nargs, char **args)
+{
+	if (nargs == 1) {
+		kprof_print();
+		return 0;
+	}
+	if (nargs == 2) {
+		if (!strcmp(args[1], "on")) {
+			return kprof_start();
+		}
+		if (!strcmp(args[1], "off")) {
+			kprof_stop();
+			return 0;
+		}
+		if (!strcmp(args[1], "gen")) {
+			kprof_nextgen();
+			return 0;
+		}
+		if (!strcmp(args[1], "leaks")) {
+			kprof_leaks();
+			return 0;
+		}
+	}
+	kprintf("Usage: kp [on | off | gen | leaks]\n");
+	return EINVAL;
+}
+
+static
+int
+cmd_cpustats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	cpustat_print();
+
+	return 0;
+}
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -507,6 +556,8 @@ static const char *mainmenu[] = {
 #endif /* UW */
 #endif
 	"[kh] Kernel heap stats              ",
+	"[cs] Per-cpu event counts           ",
+	"[kp] Kernel heap profile            ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -568,6 +619,8 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "cs",		cmd_cpustats },
+	{ "kp",		cmd_kprof },
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -8,6 +8,8 @@
 #include <vfs.h>
 #include <current.h>
 #include <proc.h>
+#include <limits.h>
+#include <copyinout.h>
 
 /* handler for write() system call                  */
 /*
@@ -58,3 +60,69 @@ sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
   KASSERT(*retval >= 0);
   return 0;
 }
+
+/* handler for open() system call                  */
+/*
+ * n.b.
+ * There is no read() or lseek() yet; open files are only good
+ * for mmap(). Descriptors 0-2 are the console, so files get
+ * descriptors from 3 up.
+ */
+
+int
+sys_open(userptr_t upath, int flags, int *retval)
+{
+  struct proc *p = curproc;
+  struct vnode *vn;
+  char *path;
+  int fd, res;
+
+  DEBUG(DB_SYSCALL,"Syscall: open(%x,%d)\n",(unsigned int)upath,flags);
+
+  for (fd = STDERR_FILENO + 1; fd < OPEN_MAX; fd++) {
+    if (p->p_files[fd] == NULL) {
+      break;
+    }
+  }
+  if (fd == OPEN_MAX) {
+    return EMFILE;
+  }
+
+  path = kmalloc(PATH_MAX);
+  if (path == NULL) {
+    return ENOMEM;
+  }
+  res = copyinstr(upath, path, PATH_MAX, NULL);
+  if (res) {
+    kfree(path);
+    return res;
+  }
+  /* vfs_open destroys the path */
+  res = vfs_open(path, flags, 0, &vn);
+  kfree(path);
+  if (res) {
+    return res;
+  }
+
+  p->p_files[fd] = vn;
+  p->p_fileflags[fd] = flags;
+  *retval = fd;
+  return 0;
+}
+
+/* handler for close() system call                  */
+
+int
+sys_close(int fdesc)
+{
+  struct proc *p = curproc;
+
+  DEBUG(DB_SYSCALL,"Syscall: close(%d)\n",fdesc);
+
+  if (fdesc < 0 || fdesc >= OPEN_MAX || p->p_files[fdesc] == NULL) {
+    return EBADF;
+  }
+  vfs_close(p->p_files[fdesc]);
+  p->p_files[fdesc] = NULL;
+  return 0;
+}
@@ -34,7 +34,9 @@
  * It makes the following address space calls:
  *    - first, as_define_region once for each segment of the program;
  *    - then, as_prepare_load;
- *    - then it loads each chunk of the program;
+ *    - then as_define_backing for each segment, which records where
+ *      in the file the segment's pages come from (they are read in
+ *      on demand by vm_fault);
  *    - finally, as_complete_load.
  *
  * This gives the VM code enough flexibility to deal with even grossly
@@ -42,9 +44,6 @@
  * circumstances, as_prepare_load and as_complete_load probably don't
  * need to do anything.
  *
- * If you wanted to support memory-mapped executables you would need
- * to rearrange this to map each segment.
- *
  * To support dynamically linked executables with shared libraries
  * you'd need to change this to load the "ELF interpreter" (dynamic
  * linker). And you'd have to write a dynamic linker...
@@ -61,88 +60,36 @@
 #include <elf.h>
 
 /*
- * Load a segment at virtual address VADDR. The segment in memory
+ * Set up a segment at virtual address VADDR. The segment in memory
  * extends from VADDR up to (but not including) VADDR+MEMSIZE. The
  * segment on disk is located at file offset OFFSET and has length
  * FILESIZE.
  *
- * FILESIZE may be less than MEMSIZE; if so the remaining portion of
- * the in-memory segment should be zero-filled.
- *
- * Note that uiomove will catch it if someone tries to load an
- * executable whose load address is in kernel space. If you should
- * change this code to not use uiomove, be sure to check for this case
- * explicitly.
+ * Nothing is read here: the VM system pages the segment in from V
+ * the first time each page is touched, and zero-fills the portion
+ * past FILESIZE (if FILESIZE < MEMSIZE). as_define_region has already
+ * checked that the segment does not reach into kernel space.
  */
 static
 int
 load_segment(struct addrspace *as, struct vnode *v,
 	     off_t offset, vaddr_t vaddr, 
-	     size_t memsize, size_t filesize,
-	     int is_executable)
+	     size_t memsize, size_t filesize)
 {
-	struct iovec iov;
-	struct uio u;
-	int result;
-
 	if (filesize > memsize) {
 		kprintf("ELF: warning: segment filesize > segment memsize\n");
 		filesize = memsize;
 	}
 
-	DEBUG(DB_EXEC, "ELF: Loading %lu bytes to 0x%lx\n", 
-	      (unsigned long) filesize, (unsigned long) vaddr);
-
-	iov.iov_ubase = (userptr_t)vaddr;
-	iov.iov_len = memsize;		 // length of the memory space
-	u.uio_iov = &iov;
-	u.uio_iovcnt = 1;
-	u.uio_resid = filesize;          // amount to read from the file
-	u.uio_offset = offset;
-	u.uio_segflg = is_executable ? UIO_USERISPACE : UIO_USERSPACE;
-	u.uio_rw = UIO_READ;
-	u.uio_space = as;
-
-	result = VOP_READ(v, &u);
-	if (result) {
-		return result;
+	if (filesize == 0) {
+		/* all bss; nothing to page in from the file */
+		return 0;
 	}
 
-	if (u.uio_resid != 0) {
-		/* short read; problem with executable? */
-		kprintf("ELF: short read on segment - file truncated?\n");
-		return ENOEXEC;
-	}
-
-	/*
-	 * If memsize > filesize, the remaining space should be
-	 * zero-filled. There is no need to do this explicitly,
-	 * because the VM system should provide pages that do not
-	 * contain other processes' data, i.e., are already zeroed.
-	 *
-	 * During development of your VM system, it may have bugs that
-	 * cause it to (maybe only sometimes) not provide zero-filled
-	 * pages, which can cause user programs to fail in strange
-	 * ways. Explicitly zeroing program BSS may help identify such
-	 * bugs, so the following disabled code is provided as a
-	 * diagnostic tool. Note that it must be disabled again before
-	 * you submit your code for grading.
-	 */
-#if 0
-	{
-		size_t fillamt;
+	DEBUG(DB_EXEC, "ELF: Mapping %lu bytes at 0x%lx\n", 
+	      (unsigned long) filesize, (unsigned long) vaddr);
 
-		fillamt = memsize - filesize;
-		if (fillamt > 0) {
-			DEBUG(DB_EXEC, "ELF: Zero-filling %lu more bytes\n", 
-			      (unsigned long) fillamt);
-			u.uio_resid += fillamt;
-			result = uiomovezeros(fillamt, &u);
-		}
-	}
-#endif
-	
-	return result;
+	return as_define_backing(as, v, offset, vaddr, filesize);
 }
 
 /*
@@ -289,8 +236,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 		}
 
 		result = load_segment(as, v, ph.p_offset, ph.p_vaddr, 
-				      ph.p_memsz, ph.p_filesz,
-				      ph.p_flags & PF_X);
+				      ph.p_memsz, ph.p_filesz);
 		if (result) {
 			return result;
 		}
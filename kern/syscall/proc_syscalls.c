@@ -10,6 +10,7 @@
 #include <addrspace.h>
 #include <copyinout.h>
 #include <synch.h>
+#include <spinlock.h>
 #include <spl.h>
 #include <mips/trapframe.h>
 #include <limits.h>
@@ -25,6 +26,8 @@ void sys__exit(int exitcode, int type) {
 
   DEBUG(DB_SYSCALL,"Syscall: _exit(%d)\n",exitcode);
   KASSERT(curproc->p_addrspace != NULL);
+  DEBUG(DB_VM,"%s: stack high-water mark %u pages\n",
+	p->p_name,(unsigned)curproc->p_addrspace->as_stackmax);
   as_deactivate();
   /*
    * clear p_addrspace before calling as_destroy. Otherwise if
@@ -35,6 +38,7 @@ void sys__exit(int exitcode, int type) {
    */
   as = curproc_setas(NULL);
   as_destroy(as);
+  proc_closefiles(p);
 
 
   lock_acquire(p->proc_exit_lock);
@@ -164,124 +168,383 @@ int sys_fork(struct trapframe * tf, pid_t * retval){
 }
 
 
-int sys_execv(userptr_t progname_ptr, userptr_t args_ptr){
+/*
+ * Staging areas for execv: the program name, and the argument strings
+ * and argv array laid out just as they go on the new user stack, so
+ * they go out in one copyout. They're too big to kmalloc on every
+ * exec, so a few are kept around once used.
+ */
+struct execbuf {
+	char eb_path[PATH_MAX];
+	char eb_args[ARG_MAX];
+	struct execbuf *eb_next;
+};
+
+#define EXECBUF_KEEP   2	/* staging areas kept when not in use */
+#define EXECARGS_CHUNK 16	/* argv pointers fetched per copyin */
+
+static struct execbuf *execbuf_free;
+static unsigned execbuf_nfree;
+static struct spinlock execbuf_lock = SPINLOCK_INITIALIZER;
+
+static
+struct execbuf *
+execbuf_get(void)
+{
+	struct execbuf *eb;
 
-	
-	char* prog_name = kmalloc(PATH_MAX); 
-	size_t prog_name_len;
-	if((char*)progname_ptr == NULL || (char**)args_ptr == NULL){
-		return EFAULT;
+	spinlock_acquire(&execbuf_lock);
+	eb = execbuf_free;
+	if (eb != NULL) {
+		execbuf_free = eb->eb_next;
+		execbuf_nfree--;
 	}
-	int argc = 0;
-	char** args_ptrs = kmalloc(ARG_MAX);
-        while(1){
-                char* arg = NULL;
-                copyin(args_ptr+argc*sizeof(char*), &arg, sizeof(char*));
-		args_ptrs[argc] = arg;
-		if(arg != NULL){
-			argc++;
-		}else{
-			break;
-		}
-	}
-	if(argc> 64){
-		return E2BIG;
+	spinlock_release(&execbuf_lock);
+
+	if (eb == NULL) {
+		eb = kmalloc(sizeof(struct execbuf));
 	}
+	return eb;
+}
 
-	int result_prog_name = copyinstr(progname_ptr,prog_name,PATH_MAX, &prog_name_len);
-	if(result_prog_name != 0){
-		return result_prog_name;
+static
+void
+execbuf_put(struct execbuf *eb)
+{
+	spinlock_acquire(&execbuf_lock);
+	if (execbuf_nfree < EXECBUF_KEEP) {
+		eb->eb_next = execbuf_free;
+		execbuf_free = eb;
+		execbuf_nfree++;
+		eb = NULL;
 	}
+	spinlock_release(&execbuf_lock);
+
+	kfree(eb);
+}
+
+/*
+ * Copy in the argument vector UARGV to EB. The strings are packed
+ * from the bottom of eb_args up, and their offsets recorded from the
+ * top down; the two may not meet, leaving room for the NULL at the
+ * end of argv, so the whole lot fits in ARG_MAX. The pointers are
+ * fetched up to EXECARGS_CHUNK at a time, but never across a page
+ * boundary, since argv may end just before an unmapped page. (So a
+ * misaligned argv, whose pointers would straddle the boundary, is
+ * rejected.)
+ *
+ * Sets *ARGC and *STRBYTES, the space the strings take.
+ */
+static
+int
+execargs_copyin(struct execbuf *eb, userptr_t uargv,
+		int *argc, size_t *strbytes)
+{
+	userptr_t chunk[EXECARGS_CHUNK];
+	uint32_t *offsets = (uint32_t *)(eb->eb_args + ARG_MAX);
+	size_t used = 0, room, len, n, i;
+	int nargs = 0, result;
 
+	if ((vaddr_t)uargv % sizeof(userptr_t) != 0) {
+		return EFAULT;
+	}
 
-	char* argv = kmalloc(ARG_MAX);
-	size_t * arg_offsets = kmalloc(argc * sizeof(size_t));
-        int offset = 0;
-	for(int i = 0; i < argc; i++){
-		//char* arg = kmalloc(ARG_MAX);
-		size_t arg_len;
-		int result = copyinstr((userptr_t)args_ptrs[i],
-				 argv+offset, ARG_MAX - offset, &arg_len );
-		if(result != 0){
+	while (1) {
+		n = (PAGE_SIZE - ((vaddr_t)uargv & (PAGE_SIZE - 1))) /
+			sizeof(userptr_t);
+		if (n > EXECARGS_CHUNK) {
+			n = EXECARGS_CHUNK;
+		}
+		result = copyin(uargv, chunk, n * sizeof(userptr_t));
+		if (result) {
 			return result;
 		}
-		arg_offsets[i] = offset;
-		offset += ROUNDUP(arg_len+1,8);
-		//argv[i] = arg;
+
+		for (i=0; i<n; i++) {
+			if (chunk[i] == NULL) {
+				*argc = nargs;
+				*strbytes = used;
+				return 0;
+			}
+			/* Room for this offset and the NULL, at least. */
+			room = ARG_MAX - (nargs + 2) * sizeof(uint32_t);
+			if (used >= room) {
+				return E2BIG;
+			}
+			result = copyinstr(chunk[i], eb->eb_args + used,
+					   room - used, &len);
+			if (result == ENAMETOOLONG) {
+				return E2BIG;
+			}
+			if (result) {
+				return result;
+			}
+			offsets[-(nargs + 1)] = used;
+			used += len;
+			nargs++;
+		}
+		uargv += n * sizeof(userptr_t);
+	}
+}
+
+/*
+ * Turn what execargs_copyin left in EB into the image of the top of
+ * the user stack: the strings, then (aligned) argv. The image is to
+ * go at user address BASE. Returns its size, and the user address of
+ * argv in *UARGV.
+ */
+static
+size_t
+execargs_layout(struct execbuf *eb, int argc, size_t strbytes,
+		vaddr_t base, vaddr_t *uargv)
+{
+	uint32_t *offsets = (uint32_t *)(eb->eb_args + ARG_MAX) - argc;
+	uint32_t *argv, tmp;
+	size_t argvoff;
+	int i;
+
+	/* The offsets are in reverse order; turn them around... */
+	for (i=0; i<argc/2; i++) {
+		tmp = offsets[i];
+		offsets[i] = offsets[argc - 1 - i];
+		offsets[argc - 1 - i] = tmp;
 	}
 
-	// prog_name (char*)   AND   argv (char*)
+	/* ...move them down to just after the strings... */
+	argvoff = ROUNDUP(strbytes, sizeof(uint32_t));
+	KASSERT(argvoff + (argc + 1) * sizeof(uint32_t) <= ARG_MAX);
+	argv = (uint32_t *)(eb->eb_args + argvoff);
+	memmove(argv, offsets, argc * sizeof(uint32_t));
 
-	struct addrspace *curproc_as = curproc_getas();
-	
+	/* ...and make them user pointers. */
+	for (i=0; i<argc; i++) {
+		argv[i] += base;
+	}
+	argv[argc] = 0;
 
+	*uargv = base + argvoff;
+	return argvoff + (argc + 1) * sizeof(uint32_t);
+}
+
+/*
+ * Copy in the program name PROGNAME and the arguments UARGV for
+ * execv or spawn into a staging area, handed back in *EBP.
+ */
+static
+int
+exec_copyin(userptr_t progname, userptr_t uargv, struct execbuf **ebp,
+	    int *argc, size_t *strbytes)
+{
+	struct execbuf *eb;
+	size_t len;
+	int result;
+
+	eb = execbuf_get();
+	if (eb == NULL) {
+		return ENOMEM;
+	}
+
+	result = copyinstr(progname, eb->eb_path, PATH_MAX, &len);
+	if (result == 0) {
+		result = execargs_copyin(eb, uargv, argc, strbytes);
+	}
+	if (result) {
+		execbuf_put(eb);
+		return result;
+	}
+	*ebp = eb;
+	return 0;
+}
+
+/*
+ * Load the program and arguments staged in EB into a new address
+ * space and make that curproc's. Hands back the old address space
+ * (which may be NULL) in *OLDAS, for the caller to destroy, and what
+ * enter_new_process needs. On failure curproc is left as it was.
+ */
+static
+int
+exec_load(struct execbuf *eb, int argc, size_t strbytes,
+	  struct addrspace **oldas, vaddr_t *entrypoint,
+	  vaddr_t *stackptr, vaddr_t *argvptr)
+{
 	struct addrspace *as;
 	struct vnode *v;
-	vaddr_t entrypoint, stackptr;
-	vaddr_t cur_ptr;
+	vaddr_t top, base;
+	size_t len;
 	int result;
+
 	/* Open the file. */
-	result = vfs_open(prog_name, O_RDONLY, 0, &v);
+	result = vfs_open(eb->eb_path, O_RDONLY, 0, &v);
 	if (result) {
 		return result;
 	}
 
-	/* Create a new address space. */
+	/* Create a new address space, and switch to it. */
 	as = as_create();
-	if (as ==NULL) {
+	if (as == NULL) {
 		vfs_close(v);
 		return ENOMEM;
 	}
-	/* Switch to it and activate it. */
-	curproc_setas(as);
+	*oldas = curproc_setas(as);
 	as_activate();
+
 	/* Load the executable. */
-	result = load_elf(v, &entrypoint);
-	if (result) {
-		/* p_addrspace will go away when curproc is destroyed */
-		vfs_close(v);
-		return result;
-	}
-	/* Done with the file now. */
+	result = load_elf(v, entrypoint);
 	vfs_close(v);
-	/* Define the user stack in the address space */
-	result = as_define_stack(as, &stackptr);
-
-	// Have both argc and prog_name ready for runprogram
-	cur_ptr = stackptr;
-	cur_ptr -= offset;
-	result = copyout(argv, (userptr_t)cur_ptr, offset);
-	if(result != 0){
-		return result;
+	if (result) {
+		goto fail;
 	}
 
-	userptr_t * arg_offsets_up = kmalloc(sizeof(userptr_t) * (argc+1));
-	for(int i = 0; i < argc; i++){
-		userptr_t ptr = (userptr_t)cur_ptr +  arg_offsets[i];
-		arg_offsets_up[i] = ptr;
+	/* Define the user stack and put the arguments on it. */
+	result = as_define_stack(as, &top);
+	if (result) {
+		goto fail;
 	}
-	arg_offsets_up[argc] = NULL;
+	len = ROUNDUP(strbytes, sizeof(uint32_t)) +
+		(argc + 1) * sizeof(uint32_t);
+	base = (top - len) & ~(vaddr_t)7;	/* keep sp 8-aligned */
+	len = execargs_layout(eb, argc, strbytes, base, argvptr);
+	result = copyout(eb->eb_args, (userptr_t)base, len);
+	if (result) {
+		goto fail;
+	}
+
+	*stackptr = base;
+	return 0;
 
-	cur_ptr -= sizeof(userptr_t) * (argc+1);
+ fail:
+	/* Go back to the old program, if any. */
+	curproc_setas(*oldas);
+	as_activate();
+	as_destroy(as);
+	return result;
+}
 
-	result = copyout(arg_offsets_up, (userptr_t)cur_ptr, sizeof(userptr_t) * (argc+1) );
+int
+sys_execv(userptr_t progname, userptr_t uargv)
+{
+	struct execbuf *eb;
+	struct addrspace *oldas;
+	vaddr_t entrypoint, stackptr, argvptr;
+	size_t strbytes;
+	int argc, result;
 
-	if(result != 0){
+	result = exec_copyin(progname, uargv, &eb, &argc, &strbytes);
+	if (result) {
+		return result;
+	}
+	result = exec_load(eb, argc, strbytes, &oldas,
+			   &entrypoint, &stackptr, &argvptr);
+	execbuf_put(eb);
+	if (result) {
 		return result;
 	}
 
-	as_destroy(curproc_as);
-	kfree(arg_offsets);
-	kfree(arg_offsets_up);
-	kfree(argv);
-	kfree(args_ptrs);
-	kfree(prog_name);
+	/* No going back now. */
+	as_destroy(oldas);
 
-	enter_new_process(argc /*argc*/, (userptr_t)cur_ptr /*userspace addr of argv*/,
-	cur_ptr, entrypoint);
+	enter_new_process(argc, (userptr_t)argvptr, stackptr, entrypoint);
 	/* enter_new_process does not return. */
 	panic("enter_new_process returned\n");
 	return EINVAL;
+}
+
+/*
+ * What sys_spawn hands the new process's thread. The parent waits on
+ * sa_loaded, so this can live on its stack.
+ */
+struct spawnargs {
+	struct execbuf *sa_eb;
+	int sa_argc;
+	size_t sa_strbytes;
+	struct semaphore *sa_loaded;
+	int sa_result;
+};
+
+static
+void
+spawn_child_entry(void *data, unsigned long unused)
+{
+	struct spawnargs *sa = data;
+	struct addrspace *oldas;
+	vaddr_t entrypoint, stackptr, argvptr;
+	int argc = sa->sa_argc;
+	int result;
+
+	(void)unused;
+
+	result = exec_load(sa->sa_eb, argc, sa->sa_strbytes, &oldas,
+			   &entrypoint, &stackptr, &argvptr);
+	sa->sa_result = result;
+	if (result) {
+		/* The parent cleans up the process. */
+		proc_remthread(curthread);
+		V(sa->sa_loaded);
+		thread_exit();
+	}
+	KASSERT(oldas == NULL);
+	/* sa is gone once the parent runs. */
+	V(sa->sa_loaded);
+
+	enter_new_process(argc, (userptr_t)argvptr, stackptr, entrypoint);
+	/* enter_new_process does not return. */
+	panic("enter_new_process returned\n");
+}
+
+/*
+ * Start the program PROGNAME with arguments UARGV in a new child
+ * process, as fork followed by execv in the child would, but without
+ * copying our address space only to throw the copy away. The child
+ * gets our open files. We wait until the program is loaded, so that
+ * failing to load it is our error rather than the child's exit code.
+ */
+int
+sys_spawn(userptr_t progname, userptr_t uargv, pid_t *retval)
+{
+	struct spawnargs sa;
+	struct proc *child_proc;
+	pid_t pid;
+	int result;
+
+	result = exec_copyin(progname, uargv, &sa.sa_eb, &sa.sa_argc,
+			     &sa.sa_strbytes);
+	if (result) {
+		return result;
+	}
+	sa.sa_result = 0;
+	sa.sa_loaded = sem_create("spawn", 0);
+	if (sa.sa_loaded == NULL) {
+		execbuf_put(sa.sa_eb);
+		return ENOMEM;
+	}
+
+	child_proc = proc_spawn(curproc, sa.sa_eb->eb_path);
+	if (child_proc == NULL) {
+		result = ENOMEM;
+		goto out;
+	}
+	pid = child_proc->pid;
+	result = thread_fork(sa.sa_eb->eb_path, child_proc,
+			     spawn_child_entry, &sa, 0);
+	if (result) {
+		proc_forget_child(curproc, child_proc);
+		proc_destroy(child_proc);
+		goto out;
+	}
+
+	P(sa.sa_loaded);
+	result = sa.sa_result;
+	if (result) {
+		/* Its thread has already left it. */
+		proc_forget_child(curproc, child_proc);
+		proc_destroy(child_proc);
+		goto out;
+	}
+	*retval = pid;
 
-	//return 0;
+ out:
+	sem_destroy(sa.sa_loaded);
+	execbuf_put(sa.sa_eb);
+	return result;
 }
@@ -0,0 +1,161 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <limits.h>
+#include <vnode.h>
+#include <syscall.h>
+#include <current.h>
+#include <proc.h>
+#include <addrspace.h>
+
+/* handler for sbrk() system call                  */
+/*
+ * Moves the end of the heap by amount bytes and returns the old
+ * end. The heap starts out empty on the page after the data
+ * segment; pages are only given memory when touched.
+ */
+int
+sys_sbrk(intptr_t amount, vaddr_t *retval)
+{
+  struct addrspace *as;
+
+  DEBUG(DB_SYSCALL,"Syscall: sbrk(%d)\n",(int)amount);
+
+  as = curproc_getas();
+  KASSERT(as != NULL);
+  return as_sbrk(as, amount, retval);
+}
+
+/* handler for mmap() system call                  */
+/*
+ * Maps len bytes of the file open as fd, from offset on, at an
+ * address of the kernel's choosing (addr is only a hint, and
+ * ignored). With MAP_ANON there is no file and the pages start out
+ * zero. Pages are read in as they are touched.
+ */
+int
+sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+	 off_t offset, vaddr_t *retval)
+{
+  struct proc *p = curproc;
+  struct vnode *vn;
+  struct stat st;
+  unsigned perm;
+  size_t filesize;
+  bool shared;
+  int accmode, res;
+
+  DEBUG(DB_SYSCALL,"Syscall: mmap(%x,%u,%d,%d,%d)\n",
+	(unsigned int)addr,(unsigned)len,prot,flags,fd);
+  (void)addr;
+
+  if (len == 0 || (flags & ~(MAP_SHARED|MAP_PRIVATE|MAP_ANON)) != 0 ||
+      (prot & ~(PROT_READ|PROT_WRITE|PROT_EXEC)) != 0) {
+    return EINVAL;
+  }
+  /* More than all of user space can't fit, and would overflow below. */
+  if (len > USERSTACK) {
+    return ENOMEM;
+  }
+  switch (flags & (MAP_SHARED|MAP_PRIVATE)) {
+  case MAP_SHARED:
+    shared = true;
+    break;
+  case MAP_PRIVATE:
+    shared = false;
+    break;
+  default:
+    return EINVAL;
+  }
+
+  perm = 0;
+  if (prot & PROT_READ) {
+    perm |= VR_READ;
+  }
+  if (prot & PROT_WRITE) {
+    perm |= VR_WRITE;
+  }
+  if (prot & PROT_EXEC) {
+    perm |= VR_EXEC;
+  }
+
+  if (flags & MAP_ANON) {
+    return as_mmap(curproc_getas(), len, perm, shared, NULL, 0, 0, retval);
+  }
+
+  if (offset < 0 || (offset & (PAGE_SIZE - 1)) != 0) {
+    return EINVAL;
+  }
+  if (fd < 0 || fd >= OPEN_MAX || p->p_files[fd] == NULL) {
+    return EBADF;
+  }
+  vn = p->p_files[fd];
+  accmode = p->p_fileflags[fd] & O_ACCMODE;
+  if (accmode == O_WRONLY ||
+      (shared && (prot & PROT_WRITE) && accmode != O_RDWR)) {
+    return EACCES;
+  }
+
+  res = VOP_MMAP(vn);
+  if (res) {
+    return res;
+  }
+  res = VOP_STAT(vn, &st);
+  if (res) {
+    return res;
+  }
+  /* Past the end of the file the mapping reads as zeroes. */
+  filesize = 0;
+  if (st.st_size > offset) {
+    filesize = st.st_size - offset < (off_t)len ? st.st_size - offset : len;
+  }
+
+  return as_mmap(curproc_getas(), len, perm, shared, vn, offset,
+		 filesize, retval);
+}
+
+/* handler for munmap() system call                  */
+/*
+ * Only whole mappings made by mmap() can be unmapped. Written pages
+ * of shared mappings go back to the file first.
+ */
+int
+sys_munmap(userptr_t addr, size_t len)
+{
+  DEBUG(DB_SYSCALL,"Syscall: munmap(%x,%u)\n",
+	(unsigned int)addr,(unsigned)len);
+
+  if (len == 0 || len > USERSTACK) {
+    return EINVAL;
+  }
+  return as_munmap(curproc_getas(), (vaddr_t)addr, len);
+}
+
+/* handler for msync() system call                  */
+/*
+ * Writes the dirty pages of the shared file mappings covering len
+ * bytes at addr back to their files. Writes are always done before
+ * returning, so MS_ASYNC is the same as MS_SYNC, and writing back
+ * already drops the stale copies MS_INVALIDATE asks about.
+ */
+int
+sys_msync(userptr_t addr, size_t len, int flags)
+{
+  vaddr_t vaddr = (vaddr_t)addr;
+
+  DEBUG(DB_SYSCALL,"Syscall: msync(%x,%u,%d)\n",
+	(unsigned int)addr,(unsigned)len,flags);
+
+  if ((flags & ~(MS_ASYNC|MS_SYNC|MS_INVALIDATE)) != 0 ||
+      (flags & (MS_ASYNC|MS_SYNC)) == (MS_ASYNC|MS_SYNC) ||
+      (vaddr & (PAGE_SIZE - 1)) != 0) {
+    return EINVAL;
+  }
+  if (vaddr >= USERSTACK || len > USERSTACK - vaddr) {
+    return ENOMEM;
+  }
+  return as_msync(curproc_getas(), vaddr, len);
+}
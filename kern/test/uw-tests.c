@@ -218,7 +218,7 @@ vmstats_thread(void *junk, unsigned long num)
             }
             break;
 
-          /* VMSTAT_PAGE_FAULT_DISK = VMSTAT_ELF_FILE_READ + VMSTAT_SWAP_FILE_READ */
+          /* VMSTAT_PAGE_FAULT_DISK = VMSTAT_ELF_FILE_READ + VMSTAT_MMAP_FILE_READ + VMSTAT_SWAP_FILE_READ */
           case VMSTAT_PAGE_FAULT_DISK:
             if (i % 2 == 0) {
                vmstats_inc(j);
@@ -232,7 +232,13 @@ vmstats_thread(void *junk, unsigned long num)
             break;
 
           case VMSTAT_SWAP_FILE_READ:
-            if (i % 4 == 0) {
+            if (i % 8 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_MMAP_FILE_READ:
+            if (i % 8 == 4) {
                vmstats_inc(j);
             }
             break;
@@ -243,6 +249,26 @@ vmstats_thread(void *junk, unsigned long num)
             }
             break;
 
+          case VMSTAT_TLB_ASID_REUSE:
+            vmstats_inc(j);
+            break;
+
+          case VMSTAT_TLB_ASID_ROLLOVER:
+            if (i % 8 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_TLB_SHOOTDOWN:
+            if (i % 4 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_TLB_FAULTAROUND:
+            vmstats_inc(j);
+            break;
+
           default:
             kprintf("Unknown stat %d\n", j);
             break;
@@ -34,6 +34,8 @@
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
+#include <cpustat.h>
+#include <mainbus.h>
 
 /*
  * Time handling.
@@ -52,6 +54,10 @@
  */
 #define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
+#define TICKLESS_HARDCLOCKS	HZ	/* Most ticks to skip at once. */
+
+/* True if going from FROM to TO hardclocks passed a multiple of N. */
+#define HARDCLOCK_CROSSED(from, to, n)	((from) / (n) != (to) / (n))
 
 /*
  * Once a second, everything waiting on lbolt is awakened by CPU 0.
@@ -83,23 +89,73 @@ timerclock(void)
 
 /*
  * This is called HZ times a second (on each processor) by the timer
- * code.
+ * code, or less often if the processor has stopped its tick; then
+ * c_tickspan ticks have gone by since the last call.
  */
 void
 hardclock(void)
 {
-	/*
-	 * Collect statistics here as desired.
-	 */
+	unsigned prev;
+
+	cpustat_inc(CPUSTAT_CLOCKINT);
+	if (curcpu->c_tickspan > 1) {
+		cpustat_add(CPUSTAT_TICKSKIP, curcpu->c_tickspan - 1);
+	}
 
-	curcpu->c_hardclocks++;
-	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
+	prev = curcpu->c_hardclocks;
+	curcpu->c_hardclocks += curcpu->c_tickspan;
+	if (HARDCLOCK_CROSSED(prev, curcpu->c_hardclocks,
+			      SCHEDULE_HARDCLOCKS)) {
 		schedule();
 	}
-	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
+	if (HARDCLOCK_CROSSED(prev, curcpu->c_hardclocks,
+			      MIGRATE_HARDCLOCKS)) {
 		thread_consider_migration();
 	}
-	thread_yield();
+	thread_timeslice();
+}
+
+/*
+ * Tickless operation.
+ *
+ * An idle cpu, or one running a single thread with nothing waiting
+ * behind it, has no use for hardclock: there's nothing to switch to,
+ * and the boosts and migration it would do have nothing to act on.
+ * Such a cpu stops its tick by having the timer interrupt it only
+ * every TICKLESS_HARDCLOCKS ticks. As soon as there's something to
+ * schedule again the thread code calls hardclock_start, which counts
+ * the ticks skipped so far and goes back to one interrupt per tick
+ * from the end of the current one.
+ *
+ * This doesn't affect lbolt, which is driven by a separate timer
+ * through timerclock(), so clocksleep keeps time either way.
+ */
+void
+hardclock_stop(void)
+{
+	KASSERT(curthread->t_curspl > 0);
+
+	if (curcpu->c_tickspan == 1) {
+		curcpu->c_tickspan = TICKLESS_HARDCLOCKS;
+		mainbus_timer_set(curcpu->c_tickspan);
+	}
+}
+
+void
+hardclock_start(void)
+{
+	unsigned elapsed;
+
+	KASSERT(curthread->t_curspl > 0);
+
+	if (curcpu->c_tickspan == 1) {
+		return;
+	}
+	elapsed = mainbus_timer_elapsed();
+	curcpu->c_hardclocks += elapsed;
+	cpustat_add(CPUSTAT_TICKSKIP, elapsed);
+	curcpu->c_tickspan = 1;
+	mainbus_timer_set(elapsed + 1);
 }
 
 /*
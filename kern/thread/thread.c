@@ -48,7 +48,9 @@
 #include <current.h>
 #include <synch.h>
 #include <addrspace.h>
+#include <coremap.h>
 #include <mainbus.h>
+#include <clock.h>
 #include <vnode.h>
 
 #include "opt-synchprobs.h"
@@ -72,6 +74,11 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/* Scheduling levels and their quanta, in hardclocks; see schedule(). */
+#define MLFQ_LEVELS		4
+#define MLFQ_BOOST_HARDCLOCKS	100	/* Boost everyone every 100. */
+static const unsigned mlfq_quanta[MLFQ_LEVELS] = { 2, 4, 8, 16 };
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -144,6 +151,11 @@ thread_create(const char *name)
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
 
+	/* Scheduler fields; new threads start at the top */
+	thread->t_prio = 0;
+	thread->t_quantum = mlfq_quanta[0];
+	thread->t_lastran = 0;
+
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
 	thread->t_curspl = IPL_HIGH;
@@ -180,19 +192,26 @@ cpu_create(unsigned hardware_number)
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
+	c->c_lastboost = 0;
+	c->c_tickspan = 1;
+	bzero(c->c_stats, sizeof(c->c_stats));
 
 	c->c_isidle = false;
+	c->c_tickless = false;
 	threadlist_init(&c->c_runqueue);
 	spinlock_init(&c->c_runqueue_lock);
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
+	c->c_shootdown_posted = 0;
+	c->c_shootdown_done = 0;
 	spinlock_init(&c->c_ipi_lock);
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
 	if (result != 0) {
 		panic("cpu_create: array_add: %s\n", strerror(result));
 	}
+	c->c_stealseed = 0x9e3779b9 * (c->c_number + 1);
 
 	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
 	c->c_curthread = thread_create(namebuf);
@@ -426,6 +445,43 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Put T on the run queue of C, behind everything at its level or
+ * better. If C had stopped its tick to run its one thread alone, it
+ * now has to start it again.
+ */
+static
+void
+runqueue_insert(struct cpu *c, struct thread *t)
+{
+	struct threadlistnode *tln;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+	KASSERT(t->t_prio < MLFQ_LEVELS);
+
+	/* (THREADLIST_FORALL_REV doesn't cope with an empty list.) */
+	for (tln = c->c_runqueue.tl_tail.tln_prev; tln->tln_prev != NULL;
+	     tln = tln->tln_prev) {
+		if (tln->tln_self->t_prio <= t->t_prio) {
+			threadlist_insertafter(&c->c_runqueue, tln->tln_self, t);
+			break;
+		}
+	}
+	if (tln->tln_prev == NULL) {
+		threadlist_addhead(&c->c_runqueue, t);
+	}
+
+	if (c->c_tickless) {
+		c->c_tickless = false;
+		if (c == curcpu->c_self) {
+			hardclock_start();
+		}
+		else {
+			ipi_send(c, IPI_UNIDLE);
+		}
+	}
+}
+
 /*
  * Make a thread runnable.
  *
@@ -450,7 +506,7 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 
 	isidle = targetcpu->c_isidle;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	runqueue_insert(targetcpu, target);
 	if (isidle) {
 		/*
 		 * Other processor is idle; send interrupt to make
@@ -464,6 +520,103 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 }
 
+/*
+ * Work stealing.
+ *
+ * A cpu that is about to go idle looks for another cpu with threads
+ * waiting and takes one. The victim is the cpu with the most threads
+ * waiting. The counts are read without the run queue locks; they're
+ * only a hint, and taking every lock just to look would slow down the
+ * busy cpus. The search starts at a random cpu, so that ties are
+ * broken differently each time and idle cpus don't all pile onto the
+ * same victim.
+ *
+ * From the victim's run queue we take a thread from the tail end,
+ * which is the lowest level and would wait longest there. Among the
+ * last STEAL_SCAN threads, we prefer the first whose cache has
+ * probably gone cold: one that last stopped running at least
+ * STEAL_COLD_HARDCLOCKS ago. Failing that, the last thread is taken
+ * anyway, since waiting for it costs more than a warm cache saves.
+ *
+ * Returns true if a thread was stolen; it's put on our own run queue.
+ */
+#define STEAL_SCAN		4
+#define STEAL_COLD_HARDCLOCKS	2
+
+static
+bool
+thread_steal(void)
+{
+	struct cpu *c, *victim;
+	struct threadlistnode *tln;
+	struct thread *t, *pick;
+	unsigned i, n, numcpus, start, count, most;
+
+	numcpus = cpuarray_num(&allcpus);
+	if (numcpus < 2) {
+		return false;
+	}
+
+	curcpu->c_stealseed = curcpu->c_stealseed * 1103515245 + 12345;
+	start = (curcpu->c_stealseed >> 16) % numcpus;
+
+	victim = NULL;
+	most = 0;
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, (start + i) % numcpus);
+		if (c == curcpu->c_self) {
+			continue;
+		}
+		count = c->c_runqueue.tl_count;
+		if (count > most) {
+			most = count;
+			victim = c;
+		}
+	}
+	if (victim == NULL) {
+		return false;
+	}
+
+	spinlock_acquire(&victim->c_runqueue_lock);
+	pick = NULL;
+	n = 0;
+	for (tln = victim->c_runqueue.tl_tail.tln_prev;
+	     tln->tln_prev != NULL && n < STEAL_SCAN; tln = tln->tln_prev) {
+		t = tln->tln_self;
+		/* See thread_consider_migration for why this can happen. */
+		if (t == victim->c_curthread) {
+			continue;
+		}
+		n++;
+		if (pick == NULL) {
+			pick = t;
+		}
+		if (victim->c_hardclocks - t->t_lastran >=
+		    STEAL_COLD_HARDCLOCKS) {
+			pick = t;
+			break;
+		}
+	}
+	if (pick != NULL) {
+		threadlist_remove(&victim->c_runqueue, pick);
+	}
+	spinlock_release(&victim->c_runqueue_lock);
+
+	if (pick == NULL) {
+		return false;
+	}
+
+	pick->t_cpu = curcpu->c_self;
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	runqueue_insert(curcpu->c_self, pick);
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	cpustat_inc(CPUSTAT_STEAL);
+	DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u\n",
+	      pick->t_name, victim->c_number, curcpu->c_number);
+	return true;
+}
+
 /*
  * Create a new thread based on an existing one.
  *
@@ -580,6 +733,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		return;
 	}
 
+	/* Note when it stopped, for thread_steal. */
+	cur->t_lastran = curcpu->c_hardclocks;
+
 	/* Put the thread in the right place. */
 	switch (newstate) {
 	    case S_RUN:
@@ -627,6 +783,18 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	 * Note that c_isidle becomes true briefly even if we don't go
 	 * idle. However, because one is supposed to hold the runqueue
 	 * lock to look at it, this should not be visible or matter.
+	 *
+	 * Before actually idling, we try to steal a thread from
+	 * another cpu that has some waiting. Failing that, we zero a
+	 * free page for the VM system's pool of pre-zeroed pages if it
+	 * wants one, and then check the runqueue again. This is one
+	 * page at a time, so anything that shows up on the runqueue
+	 * meanwhile doesn't wait long; interrupts are only taken once
+	 * the pool is full and we go into cpu_idle.
+	 *
+	 * Nothing needs hardclock while we're idle, so we stop the
+	 * tick before cpu_idle and start it again once there's a
+	 * thread to run.
 	 */
 
 	/* The current cpu is now idle. */
@@ -635,11 +803,17 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		next = threadlist_remhead(&curcpu->c_runqueue);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			if (!thread_steal() && !coremap_prezero()) {
+				cpustat_inc(CPUSTAT_IDLE);
+				hardclock_stop();
+				cpu_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
+	curcpu->c_tickless = false;
+	hardclock_start();
 
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
@@ -650,6 +824,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	 */
 	curcpu->c_curthread = next;
 	curthread = next;
+	if (next != cur) {
+		cpustat_inc(CPUSTAT_SWITCH);
+	}
 
 	/* do the switch (in assembler in switch.S) */
 	switchframe_switch(&cur->t_context, &next->t_context);
@@ -822,17 +999,116 @@ thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * This is a multi-level feedback queue. Every thread has a level,
+ * t_prio, from 0 (the highest) to MLFQ_LEVELS-1. The run queue is
+ * kept sorted by level, first come first served within a level, so
+ * the next thread to run is always the one at its head. A thread is
+ * given mlfq_quanta[level] hardclocks to run for; if it uses them all
+ * up it moves down a level, which is where CPU hogs end up, and their
+ * quanta get longer as they go. A thread that is woken up after
+ * sleeping moves up one. Threads that are runnable only ever wait for
+ * threads at their own level or better, so a thread coming off a wait
+ * channel gets the cpu back within a hardclock or so of being woken.
+ *
+ * So that threads stuck at the bottom behind a steady stream of better
+ * ones aren't starved, every MLFQ_BOOST_HARDCLOCKS schedule() puts
+ * every thread on the cpu back at the top.
+ *
+ * All of this is done on each cpu's own run queue under its run queue
+ * lock; nothing is global.
  */
 
+/*
+ * Move T, which has just been taken off a wait channel, up a level.
+ */
+static
+void
+thread_wakeboost(struct thread *t)
+{
+	if (t->t_prio > 0) {
+		t->t_prio--;
+	}
+	t->t_quantum = mlfq_quanta[t->t_prio];
+}
+
+/*
+ * This is called periodically from hardclock(). Boosts every thread
+ * on the current CPU to the top level once in a while; the run queue
+ * stays in the same order, which is still sorted.
+ */
 void
 schedule(void)
 {
+	struct threadlistnode *tln;
+
+	if (curcpu->c_hardclocks - curcpu->c_lastboost <
+	    MLFQ_BOOST_HARDCLOCKS) {
+		return;
+	}
+	curcpu->c_lastboost = curcpu->c_hardclocks;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (tln = curcpu->c_runqueue.tl_head.tln_next; tln->tln_next != NULL;
+	     tln = tln->tln_next) {
+		tln->tln_self->t_prio = 0;
+		tln->tln_self->t_quantum = mlfq_quanta[0];
+	}
+	if (!curcpu->c_isidle) {
+		curthread->t_prio = 0;
+		curthread->t_quantum = mlfq_quanta[0];
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+}
+
+void
+thread_timeslice(void)
+{
+	struct thread *cur, *next;
+	bool preempt;
+
+	/* An idle cpu's curthread isn't running; don't charge it. */
+	if (curcpu->c_isidle) {
+		return;
+	}
+
 	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
+	 * With nothing else to run there's nothing to share the cpu
+	 * with; stop the tick until something turns up. (See
+	 * runqueue_insert.)
 	 */
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	if (threadlist_isempty(&curcpu->c_runqueue)) {
+		curcpu->c_tickless = true;
+		hardclock_stop();
+		spinlock_release(&curcpu->c_runqueue_lock);
+		return;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	cur = curthread;
+	KASSERT(cur->t_quantum > 0);
+	cur->t_quantum--;
+	if (cur->t_quantum == 0) {
+		/* Used its whole quantum; move it down. */
+		if (cur->t_prio < MLFQ_LEVELS - 1) {
+			cur->t_prio++;
+		}
+		cur->t_quantum = mlfq_quanta[cur->t_prio];
+		thread_yield();
+		return;
+	}
+
+	/* Otherwise, only give way to something more important. */
+	preempt = false;
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	if (!threadlist_isempty(&curcpu->c_runqueue)) {
+		next = curcpu->c_runqueue.tl_head.tln_next->tln_self;
+		preempt = next->t_prio < cur->t_prio;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+	if (preempt) {
+		thread_yield();
+	}
 }
 
 /*
@@ -840,7 +1116,8 @@ schedule(void)
  *
  * This is also called periodically from hardclock(). If the current
  * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
+ * threads across to those other other CPUs. (CPUs that run out of
+ * work don't wait for this; they steal it. See thread_steal.)
  *
  * Migrating threads isn't free because of cache affinity; a thread's
  * working cache set will end up having to be moved to the other CPU,
@@ -861,16 +1138,19 @@ thread_consider_migration(void)
 	struct threadlist victims;
 	struct thread *t;
 
+	/*
+	 * The counts are only a guide, so don't bother locking each
+	 * run queue to read them; see below for what happens if they
+	 * change meanwhile.
+	 */
 	my_count = total_count = 0;
 	numcpus = cpuarray_num(&allcpus);
 	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
 		total_count += c->c_runqueue.tl_count;
 		if (c == curcpu->c_self) {
 			my_count = c->c_runqueue.tl_count;
 		}
-		spinlock_release(&c->c_runqueue_lock);
 	}
 
 	one_share = DIVROUNDUP(total_count, numcpus);
@@ -882,7 +1162,12 @@ thread_consider_migration(void)
 	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 	for (i=0; i<to_send; i++) {
+		/* Idle cpus may have stolen some meanwhile. */
 		t = threadlist_remtail(&curcpu->c_runqueue);
+		if (t == NULL) {
+			to_send = i;
+			break;
+		}
 		threadlist_addhead(&victims, t);
 	}
 	spinlock_release(&curcpu->c_runqueue_lock);
@@ -924,7 +1209,8 @@ thread_consider_migration(void)
 			}
 
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			runqueue_insert(c, t);
+			cpustat_inc(CPUSTAT_MIGRATE);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -948,7 +1234,7 @@ thread_consider_migration(void)
 	if (!threadlist_isempty(&victims)) {
 		spinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			runqueue_insert(curcpu->c_self, t);
 		}
 		spinlock_release(&curcpu->c_runqueue_lock);
 	}
@@ -1050,6 +1336,7 @@ wchan_wakeone(struct wchan *wc)
 		return;
 	}
 
+	thread_wakeboost(target);
 	thread_make_runnable(target, false);
 }
 
@@ -1084,6 +1371,7 @@ wchan_wakeall(struct wchan *wc)
 	 * make each thread runnable.
 	 */
 	while ((target = threadlist_remhead(&list)) != NULL) {
+		thread_wakeboost(target);
 		thread_make_runnable(target, false);
 	}
 
@@ -1108,6 +1396,91 @@ wchan_isempty(struct wchan *wc)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Per-cpu counters
+ */
+
+void
+cpustat_inc(unsigned which)
+{
+	cpustat_add(which, 1);
+}
+
+void
+cpustat_add(unsigned which, uint32_t amount)
+{
+	int spl;
+
+	KASSERT(which < CPUSTAT_COUNT);
+
+	if (!CURCPU_EXISTS()) {
+		/* kmalloc during early boot; nowhere to count it */
+		return;
+	}
+
+	spl = splhigh();
+	curcpu->c_stats[which] += amount;
+	splx(spl);
+}
+
+uint32_t
+cpustat_get(unsigned which)
+{
+	uint32_t total = 0;
+	unsigned i;
+
+	KASSERT(which < CPUSTAT_COUNT);
+
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		total += cpuarray_get(&allcpus, i)->c_stats[which];
+	}
+	return total;
+}
+
+void
+cpustat_reset(unsigned which)
+{
+	unsigned i;
+
+	KASSERT(which < CPUSTAT_COUNT);
+
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		cpuarray_get(&allcpus, i)->c_stats[which] = 0;
+	}
+}
+
+void
+cpustat_print(void)
+{
+	static const char *const names[CPUSTAT_COUNT - VMSTAT_COUNT] = {
+		"switches", "migrated", "idle", "kmalloc", "kfree", "syscalls",
+		"kmaghits", "kmagmisses", "stolen", "clockints", "tickskips",
+	};
+	struct cpu *c;
+	unsigned i, j;
+
+	kprintf("%-4s", "cpu");
+	for (j=0; j<CPUSTAT_COUNT - VMSTAT_COUNT; j++) {
+		kprintf(" %10s", names[j]);
+	}
+	kprintf("\n");
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		kprintf("%-4u", c->c_number);
+		for (j=VMSTAT_COUNT; j<CPUSTAT_COUNT; j++) {
+			kprintf(" %10u", c->c_stats[j]);
+		}
+		kprintf("\n");
+	}
+	kprintf("%-4s", "all");
+	for (j=VMSTAT_COUNT; j<CPUSTAT_COUNT; j++) {
+		kprintf(" %10u", cpustat_get(j));
+	}
+	kprintf("\n");
+}
+
+////////////////////////////////////////////////////////////
+
 /*
  * Machine-independent IPI handling
  */
@@ -1140,26 +1513,53 @@ ipi_broadcast(int code)
 	}
 }
 
-void
+unsigned
 ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 {
-	int n;
+	unsigned ticket;
+	int i, n;
 
 	spinlock_acquire(&target->c_ipi_lock);
 
 	n = target->c_numshootdown;
-	if (n == TLBSHOOTDOWN_MAX) {
-		target->c_numshootdown = TLBSHOOTDOWN_ALL;
-	}
-	else {
-		target->c_shootdown[n] = *mapping;
-		target->c_numshootdown = n+1;
+	if (n != TLBSHOOTDOWN_ALL) {
+		/* Don't queue the same invalidation twice. */
+		for (i=0; i<n; i++) {
+			if (TLBSHOOTDOWN_SAME(&target->c_shootdown[i],
+					      mapping)) {
+				break;
+			}
+		}
+		if (i < n) {
+			/* already queued */
+		}
+		else if (n == TLBSHOOTDOWN_MAX) {
+			target->c_numshootdown = TLBSHOOTDOWN_ALL;
+		}
+		else {
+			target->c_shootdown[n] = *mapping;
+			target->c_numshootdown = n+1;
+		}
 	}
+	ticket = ++target->c_shootdown_posted;
 
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
 	mainbus_send_ipi(target);
 
 	spinlock_release(&target->c_ipi_lock);
+	return ticket;
+}
+
+void
+ipi_tlbshootdown_wait(struct cpu *target, unsigned ticket)
+{
+	KASSERT(target != curcpu->c_self);
+	/* The target may be waiting on us in turn; take its IPIs. */
+	KASSERT(curthread->t_iplhigh_count == 0);
+
+	while ((int)(target->c_shootdown_done - ticket) < 0) {
+		/* spin */
+	}
 }
 
 void
@@ -1189,8 +1589,11 @@ interprocessor_interrupt(void)
 	if (bits & (1U << IPI_UNIDLE)) {
 		/*
 		 * The cpu has already unidled itself to take the
-		 * interrupt; don't need to do anything else.
+		 * interrupt. But if it was running a thread alone,
+		 * it stopped its tick, and needs it back to share
+		 * the cpu with whatever was just added.
 		 */
+		hardclock_start();
 	}
 	if (bits & (1U << IPI_TLBSHOOTDOWN)) {
 		if (curcpu->c_numshootdown == TLBSHOOTDOWN_ALL) {
@@ -1202,6 +1605,7 @@ interprocessor_interrupt(void)
 			}
 		}
 		curcpu->c_numshootdown = 0;
+		curcpu->c_shootdown_done = curcpu->c_shootdown_posted;
 	}
 
 	curcpu->c_ipi_pending = 0;
@@ -241,15 +241,17 @@ null_fsync(struct vnode *v)
 }
 
 /*
- * For mmap. If you want this to do anything, you have to write it
- * yourself. Some devices may not make sense to map. Others do.
+ * For mmap. Mapped files are paged with VOP_READ and VOP_WRITE at
+ * page-aligned offsets, which doesn't mean anything useful for
+ * character devices and would bypass any other user of a disk, so
+ * devices can't be mapped.
  */
 static
 int
-dev_mmap(struct vnode *v  /* add stuff as needed */)
+dev_mmap(struct vnode *v)
 {
 	(void)v;
-	return EUNIMP;
+	return ENODEV;
 }
 
 /*
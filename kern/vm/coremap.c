@@ -0,0 +1,768 @@
+/*
+ * Physical page frame allocator.
+ *
+ * The coremap itself is stolen from the bottom of the memory that
+ * ram_getsize() reports, and covers every frame above it. Free frames
+ * are managed with a binary buddy system: free memory is made up of
+ * blocks of 2^k frames, each aligned (by coremap index) to its own
+ * size, with a doubly-linked free list for each order threaded through
+ * the coremap entries. An allocation of N frames takes the smallest
+ * block of at least N, splitting larger blocks in half as needed, and
+ * hands the unused tail of the block straight back. Freeing merges a
+ * block with its buddy, and the result with its buddy, as long as the
+ * buddy is free and whole. Both are O(log n) in the size of memory,
+ * and single-page allocations (by far the most common kind: subpage
+ * kmalloc pages, user pages) are O(1) as long as there are free order
+ * 0 blocks about.
+ *
+ * The block structure lives only in the free lists: the first frame
+ * of a free block records its length in cme_npages, and every other
+ * free frame has cme_npages 0. So a buddy is mergeable exactly when
+ * its first frame is free with the same cme_npages.
+ *
+ * Allocations are reference counted so that user pages can be shared
+ * copy-on-write between address spaces after fork. coremap_free drops
+ * one reference and only releases the frames when the last one goes.
+ *
+ * User pages that belong to exactly one address space also record
+ * which one and at what address, so that they can be found again to
+ * be paged out. coremap_victim picks such pages with a clock: the hand
+ * sweeps the coremap, clearing the reference bit (set by coremap_touch
+ * on every TLB miss) of pages it passes and taking the first page
+ * whose bit was already clear. Shared pages have no owner recorded and
+ * are never chosen.
+ *
+ * Free frames that are known to be all zeroes are kept on a separate
+ * list, outside the buddy system, so that pages which must start out
+ * zeroed (stack, bss) can be had without zeroing them in the faulting
+ * thread. Idle CPUs top up this pool with coremap_prezero: when it
+ * drops below CM_ZEROLOW frames they zero single frames from the buddy
+ * lists until it reaches CM_ZEROHIGH. Ordinary single-page allocations
+ * only dip into the pool when the buddy lists are empty; multi-page
+ * allocations that can't be satisfied give the whole pool back to the
+ * buddy lists, where it can merge, and try again.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <coremap.h>
+
+#define CM_NONE  0xffffffff	/* null free list link */
+
+/* Free blocks are 2^0 through 2^(CM_NORDERS-1) frames (4M). */
+#define CM_NORDERS   11
+
+struct coremap_entry {
+	uint32_t cme_next;	/* next free block (index), if free */
+	uint32_t cme_prev;	/* previous free block (index), if free */
+	uint32_t cme_npages;	/* length of allocation or free block,
+				   in its first frame */
+	uint16_t cme_refcount;	/* references, in its first frame */
+	uint8_t cme_owner;	/* CM_FREE, CM_KERNEL, or CM_USER */
+	uint8_t cme_busy;	/* being paged out */
+	uint8_t cme_zeroed;	/* free and in the zeroed pool */
+	volatile uint8_t cme_ref;	/* used since the clock last passed */
+	struct addrspace *cme_as;	/* sole user mapping, or NULL */
+	vaddr_t cme_vaddr;		/* ...and where it is mapped */
+	void *cme_heap;			/* kmalloc's record of a heap page */
+};
+
+static struct coremap_entry *coremap;
+static paddr_t cm_base;		/* physical address of frame 0 */
+static uint32_t cm_npages;	/* number of frames managed */
+static uint32_t cm_freehead[CM_NORDERS];	/* free blocks, by order */
+static uint32_t cm_nblocks[CM_NORDERS];	/* ...and how many */
+static uint32_t cm_zerohead;	/* first frame in the zeroed pool */
+static uint32_t cm_clockhand;	/* where coremap_victim looks next */
+
+static uint32_t cm_nfree;	/* free frames, zeroed pool included */
+static uint32_t cm_nkernel;
+static uint32_t cm_nuser;
+static uint32_t cm_nzero;	/* frames in the zeroed pool */
+static uint32_t cm_zerohits;	/* coremap_alloczero served from the pool */
+static uint32_t cm_zeromisses;	/* ...and had to zero a frame itself */
+static bool cm_zerofilling;	/* refilling the pool up to CM_ZEROHIGH */
+
+static bool cm_ready;
+
+/*
+ * Protects everything above. Also serializes ram_stealmem before the
+ * coremap is set up.
+ */
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+
+/* Pre-zeroed pool water marks, in frames. */
+#define CM_ZEROLOW   16
+#define CM_ZEROHIGH  64
+
+#define CM_INDEX(pa)  (((pa) - cm_base) / PAGE_SIZE)
+#define CM_PADDR(i)   (cm_base + (paddr_t)(i) * PAGE_SIZE)
+
+////////////////////////////////////////////////////////////
+// free lists
+
+static
+void
+list_insert(uint32_t *head, uint32_t i)
+{
+	coremap[i].cme_prev = CM_NONE;
+	coremap[i].cme_next = *head;
+	if (*head != CM_NONE) {
+		coremap[*head].cme_prev = i;
+	}
+	*head = i;
+}
+
+static
+void
+list_remove(uint32_t *head, uint32_t i)
+{
+	uint32_t next = coremap[i].cme_next;
+	uint32_t prev = coremap[i].cme_prev;
+
+	if (prev == CM_NONE) {
+		KASSERT(*head == i);
+		*head = next;
+	}
+	else {
+		coremap[prev].cme_next = next;
+	}
+	if (next != CM_NONE) {
+		coremap[next].cme_prev = prev;
+	}
+	coremap[i].cme_next = coremap[i].cme_prev = CM_NONE;
+}
+
+////////////////////////////////////////////////////////////
+// buddy system
+
+/*
+ * Smallest order whose blocks hold NPAGES frames.
+ */
+static
+unsigned
+buddy_order(unsigned long npages)
+{
+	unsigned order;
+
+	order = 0;
+	while ((1UL << order) < npages) {
+		order++;
+	}
+	return order;
+}
+
+/*
+ * Put the free block of 2^ORDER frames at I on the free lists,
+ * merging it with its buddy for as long as the buddy is free too.
+ */
+static
+void
+buddy_insert(uint32_t i, unsigned order)
+{
+	uint32_t b;
+
+	KASSERT((i & ((1U << order) - 1)) == 0);
+
+	while (order + 1 < CM_NORDERS) {
+		b = i ^ (1U << order);
+		if (b >= cm_npages ||
+		    coremap[b].cme_owner != CM_FREE ||
+		    coremap[b].cme_npages != (1U << order)) {
+			break;
+		}
+		list_remove(&cm_freehead[order], b);
+		cm_nblocks[order]--;
+		coremap[b].cme_npages = 0;
+		i &= ~(1U << order);
+		order++;
+	}
+	coremap[i].cme_npages = 1U << order;
+	list_insert(&cm_freehead[order], i);
+	cm_nblocks[order]++;
+}
+
+/*
+ * Take a free block of 2^ORDER frames off the free lists, splitting a
+ * larger one if need be. Returns its index, or CM_NONE.
+ */
+static
+uint32_t
+buddy_remove(unsigned order)
+{
+	unsigned o;
+	uint32_t i, b;
+
+	for (o = order; o < CM_NORDERS; o++) {
+		if (cm_freehead[o] != CM_NONE) {
+			break;
+		}
+	}
+	if (o == CM_NORDERS) {
+		return CM_NONE;
+	}
+
+	i = cm_freehead[o];
+	list_remove(&cm_freehead[o], i);
+	cm_nblocks[o]--;
+	coremap[i].cme_npages = 0;
+
+	/* Give back the upper half until it's the size asked for. */
+	while (o > order) {
+		o--;
+		b = i + (1U << o);
+		coremap[b].cme_npages = 1U << o;
+		list_insert(&cm_freehead[o], b);
+		cm_nblocks[o]++;
+	}
+	return i;
+}
+
+/*
+ * Put the free frames [START, START+NPAGES) on the free lists, as the
+ * largest aligned blocks that fit.
+ */
+static
+void
+buddy_freerange(uint32_t start, uint32_t npages)
+{
+	uint32_t end = start + npages;
+	unsigned order;
+
+	while (start < end) {
+		order = 0;
+		while (order + 1 < CM_NORDERS &&
+		       (start & ((2U << order) - 1)) == 0 &&
+		       start + (2U << order) <= end) {
+			order++;
+		}
+		buddy_insert(start, order);
+		start += 1U << order;
+	}
+}
+
+/*
+ * Give every frame in the zeroed pool back to the buddy lists.
+ */
+static
+void
+zeropool_drain(void)
+{
+	uint32_t i;
+
+	while (cm_zerohead != CM_NONE) {
+		i = cm_zerohead;
+		KASSERT(coremap[i].cme_zeroed);
+		list_remove(&cm_zerohead, i);
+		coremap[i].cme_zeroed = 0;
+		cm_nzero--;
+		buddy_insert(i, 0);
+	}
+}
+
+////////////////////////////////////////////////////////////
+
+void
+coremap_bootstrap(void)
+{
+	paddr_t lo, hi;
+	uint32_t total, i;
+	size_t cmbytes;
+
+	spinlock_acquire(&coremap_lock);
+	ram_getsize(&lo, &hi);
+
+	/*
+	 * Size the coremap for every frame from lo to hi, then take
+	 * its own pages off the bottom. This overcounts by the few
+	 * entries that would have described the coremap itself.
+	 */
+	total = (hi - lo) / PAGE_SIZE;
+	cmbytes = ROUNDUP(total * sizeof(struct coremap_entry), PAGE_SIZE);
+	KASSERT(lo + cmbytes < hi);
+
+	coremap = (struct coremap_entry *)PADDR_TO_KVADDR(lo);
+	cm_base = lo + cmbytes;
+	cm_npages = (hi - cm_base) / PAGE_SIZE;
+
+	for (i = 0; i < cm_npages; i++) {
+		coremap[i].cme_next = coremap[i].cme_prev = CM_NONE;
+		coremap[i].cme_owner = CM_FREE;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_refcount = 0;
+		coremap[i].cme_busy = 0;
+		coremap[i].cme_zeroed = 0;
+		coremap[i].cme_ref = 0;
+		coremap[i].cme_as = NULL;
+		coremap[i].cme_vaddr = 0;
+		coremap[i].cme_heap = NULL;
+	}
+	for (i = 0; i < CM_NORDERS; i++) {
+		cm_freehead[i] = CM_NONE;
+		cm_nblocks[i] = 0;
+	}
+	cm_zerohead = CM_NONE;
+	buddy_freerange(0, cm_npages);
+
+	cm_clockhand = 0;
+	cm_nfree = cm_npages;
+	cm_nkernel = cm_nuser = cm_nzero = 0;
+	cm_ready = true;
+
+	spinlock_release(&coremap_lock);
+
+	kprintf("coremap: %u frames, %uk used for the coremap\n",
+		cm_npages, cmbytes/1024);
+}
+
+/*
+ * Give the NPAGES frames starting at FIRST, which have just been
+ * taken off the free lists, to OWNER.
+ */
+static
+void
+coremap_take(uint32_t first, unsigned long npages, int owner)
+{
+	uint32_t i;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	for (i = first; i < first + npages; i++) {
+		KASSERT(coremap[i].cme_owner == CM_FREE);
+		KASSERT(coremap[i].cme_npages == 0);
+		KASSERT(!coremap[i].cme_zeroed);
+		coremap[i].cme_owner = owner;
+		coremap[i].cme_heap = NULL;
+	}
+	coremap[first].cme_npages = npages;
+	coremap[first].cme_refcount = 1;
+
+	cm_nfree -= npages;
+	if (owner == CM_KERNEL) {
+		cm_nkernel += npages;
+	}
+	else {
+		cm_nuser += npages;
+	}
+}
+
+paddr_t
+coremap_alloc(unsigned long npages, int owner)
+{
+	paddr_t pa;
+	uint32_t first;
+	unsigned order;
+
+	KASSERT(npages > 0);
+	KASSERT(owner == CM_KERNEL || owner == CM_USER);
+
+	spinlock_acquire(&coremap_lock);
+
+	if (!cm_ready) {
+		pa = ram_stealmem(npages);
+		spinlock_release(&coremap_lock);
+		return pa;
+	}
+
+	order = buddy_order(npages);
+	if (order >= CM_NORDERS) {
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+
+	first = buddy_remove(order);
+	if (first == CM_NONE && cm_zerohead != CM_NONE) {
+		if (npages == 1) {
+			first = cm_zerohead;
+			KASSERT(coremap[first].cme_zeroed);
+			list_remove(&cm_zerohead, first);
+			coremap[first].cme_zeroed = 0;
+			cm_nzero--;
+		}
+		else {
+			zeropool_drain();
+			first = buddy_remove(order);
+		}
+	}
+	if (first == CM_NONE) {
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+
+	coremap_take(first, npages, owner);
+	/* Return the part of the block we don't need. */
+	buddy_freerange(first + npages, (1U << order) - npages);
+
+	pa = CM_PADDR(first);
+	spinlock_release(&coremap_lock);
+	return pa;
+}
+
+paddr_t
+coremap_alloczero(int owner)
+{
+	paddr_t pa;
+	uint32_t first;
+	bool hit;
+
+	KASSERT(owner == CM_KERNEL || owner == CM_USER);
+	KASSERT(cm_ready);
+
+	spinlock_acquire(&coremap_lock);
+	first = cm_zerohead;
+	hit = first != CM_NONE;
+	if (hit) {
+		/* Make sure the pool hasn't picked up an unzeroed frame. */
+		KASSERT(coremap[first].cme_zeroed);
+		list_remove(&cm_zerohead, first);
+		coremap[first].cme_zeroed = 0;
+		cm_nzero--;
+		cm_zerohits++;
+	}
+	else {
+		first = buddy_remove(0);
+		if (first == CM_NONE) {
+			spinlock_release(&coremap_lock);
+			return 0;
+		}
+		cm_zeromisses++;
+	}
+	coremap_take(first, 1, owner);
+	pa = CM_PADDR(first);
+	spinlock_release(&coremap_lock);
+
+	if (!hit) {
+		bzero((void *)PADDR_TO_KVADDR(pa), PAGE_SIZE);
+	}
+	return pa;
+}
+
+void
+coremap_free(paddr_t paddr)
+{
+	uint32_t first, i, npages;
+	int owner;
+
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	spinlock_acquire(&coremap_lock);
+
+	if (!cm_ready || paddr < cm_base) {
+		/* Stolen before bootstrap; we can't take it back. */
+		spinlock_release(&coremap_lock);
+		return;
+	}
+
+	first = CM_INDEX(paddr);
+	KASSERT(first < cm_npages);
+	owner = coremap[first].cme_owner;
+	npages = coremap[first].cme_npages;
+	if (owner == CM_FREE || npages == 0) {
+		panic("coremap_free: 0x%x is not the start of an allocation\n",
+		      paddr);
+	}
+	KASSERT(first + npages <= cm_npages);
+	KASSERT(coremap[first].cme_refcount > 0);
+	KASSERT(!coremap[first].cme_busy);
+
+	if (--coremap[first].cme_refcount > 0) {
+		/* Still shared. */
+		spinlock_release(&coremap_lock);
+		return;
+	}
+
+	coremap[first].cme_as = NULL;
+	coremap[first].cme_npages = 0;
+	for (i = first; i < first + npages; i++) {
+		KASSERT(coremap[i].cme_owner == owner);
+		coremap[i].cme_owner = CM_FREE;
+	}
+	buddy_freerange(first, npages);
+
+	cm_nfree += npages;
+	if (owner == CM_KERNEL) {
+		cm_nkernel -= npages;
+	}
+	else {
+		cm_nuser -= npages;
+	}
+
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Look up the coremap entry for the allocation starting at PADDR.
+ * Must hold coremap_lock.
+ */
+static
+struct coremap_entry *
+coremap_head(paddr_t paddr)
+{
+	uint32_t i;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(cm_ready);
+	KASSERT(paddr >= cm_base && (paddr & PAGE_FRAME) == paddr);
+
+	i = CM_INDEX(paddr);
+	KASSERT(i < cm_npages);
+	KASSERT(coremap[i].cme_owner != CM_FREE);
+	KASSERT(coremap[i].cme_npages > 0);
+	return &coremap[i];
+}
+
+void
+coremap_incref(paddr_t paddr)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_head(paddr);
+	KASSERT(cme->cme_refcount > 0 && cme->cme_refcount < 0xffff);
+	KASSERT(!cme->cme_busy);
+	cme->cme_refcount++;
+	/* Shared pages can't be paged out. */
+	cme->cme_as = NULL;
+	spinlock_release(&coremap_lock);
+}
+
+unsigned
+coremap_refcount(paddr_t paddr)
+{
+	unsigned ret;
+
+	spinlock_acquire(&coremap_lock);
+	ret = coremap_head(paddr)->cme_refcount;
+	spinlock_release(&coremap_lock);
+	return ret;
+}
+
+void
+coremap_setowner(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_head(paddr);
+	KASSERT(cme->cme_owner == CM_USER && cme->cme_npages == 1);
+	KASSERT(cme->cme_refcount == 1);
+	cme->cme_as = as;
+	cme->cme_vaddr = vaddr;
+	cme->cme_ref = 1;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Called on every TLB miss, so doesn't lock: losing a race with the
+ * clock hand only costs the page its second chance.
+ */
+void
+coremap_touch(paddr_t paddr)
+{
+	if (cm_ready && paddr >= cm_base) {
+		coremap[CM_INDEX(paddr)].cme_ref = 1;
+	}
+}
+
+int
+coremap_victim(bool (*ok)(struct addrspace *),
+	       paddr_t *paddr, struct addrspace **as, vaddr_t *vaddr)
+{
+	struct coremap_entry *cme;
+	uint32_t scanned;
+
+	spinlock_acquire(&coremap_lock);
+
+	/* Two passes: the first may do nothing but clear bits. */
+	for (scanned = 0; scanned < 2 * cm_npages; scanned++) {
+		cme = &coremap[cm_clockhand];
+		cm_clockhand = (cm_clockhand + 1) % cm_npages;
+
+		if (cme->cme_as == NULL || cme->cme_busy) {
+			continue;
+		}
+		KASSERT(cme->cme_owner == CM_USER && cme->cme_refcount == 1);
+		if (cme->cme_ref) {
+			cme->cme_ref = 0;
+			continue;
+		}
+		if (!ok(cme->cme_as)) {
+			continue;
+		}
+
+		cme->cme_busy = 1;
+		*paddr = CM_PADDR(cme - coremap);
+		*as = cme->cme_as;
+		*vaddr = cme->cme_vaddr;
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+
+	spinlock_release(&coremap_lock);
+	return ENOMEM;
+}
+
+bool
+coremap_isbusy(paddr_t paddr)
+{
+	bool ret;
+
+	spinlock_acquire(&coremap_lock);
+	ret = coremap_head(paddr)->cme_busy != 0;
+	spinlock_release(&coremap_lock);
+	return ret;
+}
+
+void
+coremap_unbusy(paddr_t paddr)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_head(paddr);
+	KASSERT(cme->cme_busy);
+	cme->cme_busy = 0;
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_reclaim(paddr_t paddr, int owner)
+{
+	struct coremap_entry *cme;
+
+	KASSERT(owner == CM_KERNEL || owner == CM_USER);
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_head(paddr);
+	KASSERT(cme->cme_busy && cme->cme_owner == CM_USER);
+	KASSERT(cme->cme_refcount == 1);
+	cme->cme_busy = 0;
+	cme->cme_as = NULL;
+	cme->cme_heap = NULL;
+	if (owner == CM_KERNEL) {
+		cme->cme_owner = CM_KERNEL;
+		cm_nuser--;
+		cm_nkernel++;
+	}
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Only the kernel heap, which owns the frame, sets or looks at
+ * cme_heap, and it does so while it has the page, so these don't lock.
+ */
+void
+coremap_setheap(paddr_t paddr, void *heap)
+{
+	if (!cm_ready || paddr < cm_base) {
+		/* stolen before we were running; nothing to record */
+		return;
+	}
+	KASSERT(CM_INDEX(paddr) < cm_npages);
+	KASSERT(coremap[CM_INDEX(paddr)].cme_owner == CM_KERNEL);
+	coremap[CM_INDEX(paddr)].cme_heap = heap;
+}
+
+void *
+coremap_heap(paddr_t paddr)
+{
+	if (!cm_ready || paddr < cm_base || CM_INDEX(paddr) >= cm_npages) {
+		return NULL;
+	}
+	return coremap[CM_INDEX(paddr)].cme_heap;
+}
+
+bool
+coremap_prezero(void)
+{
+	uint32_t i;
+
+	spinlock_acquire(&coremap_lock);
+	if (!cm_ready) {
+		spinlock_release(&coremap_lock);
+		return false;
+	}
+	if (cm_nzero < CM_ZEROLOW) {
+		cm_zerofilling = true;
+	}
+	else if (cm_nzero >= CM_ZEROHIGH) {
+		cm_zerofilling = false;
+	}
+	if (!cm_zerofilling) {
+		spinlock_release(&coremap_lock);
+		return false;
+	}
+
+	/*
+	 * While we zero it the frame is on no list and, having
+	 * cme_npages 0, can't be merged with by its buddy, so nobody
+	 * else will touch it. It still counts as free.
+	 */
+	i = buddy_remove(0);
+	if (i == CM_NONE) {
+		spinlock_release(&coremap_lock);
+		return false;
+	}
+	spinlock_release(&coremap_lock);
+
+	bzero((void *)PADDR_TO_KVADDR(CM_PADDR(i)), PAGE_SIZE);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap[i].cme_owner == CM_FREE);
+	KASSERT(!coremap[i].cme_zeroed);
+	coremap[i].cme_zeroed = 1;
+	list_insert(&cm_zerohead, i);
+	cm_nzero++;
+	spinlock_release(&coremap_lock);
+	return true;
+}
+
+void
+coremap_printstats(void)
+{
+	uint32_t nfree, nkernel, nuser, nzero, hits, misses;
+	uint32_t nblocks[CM_NORDERS];
+	uint32_t buddyfree, largest;
+	unsigned i;
+
+	spinlock_acquire(&coremap_lock);
+	nfree = cm_nfree;
+	nkernel = cm_nkernel;
+	nuser = cm_nuser;
+	nzero = cm_nzero;
+	hits = cm_zerohits;
+	misses = cm_zeromisses;
+	for (i = 0; i < CM_NORDERS; i++) {
+		nblocks[i] = cm_nblocks[i];
+	}
+	spinlock_release(&coremap_lock);
+
+	kprintf("Coremap: %u frames: %u free, %u kernel, %u user\n",
+		cm_npages, nfree, nkernel, nuser);
+
+	/*
+	 * Fragmentation is the fraction of free memory (outside the
+	 * zeroed pool) that isn't in the largest free block: 0% if it
+	 * is all one block, approaching 100% if it's all single pages.
+	 */
+	buddyfree = largest = 0;
+	kprintf("Free blocks by order:");
+	for (i = 0; i < CM_NORDERS; i++) {
+		kprintf(" %u", nblocks[i]);
+		buddyfree += nblocks[i] << i;
+		if (nblocks[i] > 0) {
+			largest = 1U << i;
+		}
+	}
+	kprintf("\n");
+	kprintf("Largest free block: %u frames; fragmentation %u%%\n",
+		largest,
+		buddyfree == 0 ? 0 : 100 - (100 * largest) / buddyfree);
+
+	kprintf("Zeroed pool: %u frames (low %u, high %u): "
+		"%u hits, %u misses\n",
+		nzero, CM_ZEROLOW, CM_ZEROHIGH, hits, misses);
+}
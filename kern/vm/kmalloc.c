@@ -29,8 +29,17 @@
 
 #include <types.h>
 #include <lib.h>
+#include <spl.h>
 #include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <platform/maxcpus.h>
+#include <cpustat.h>
 #include <vm.h>
+#include <coremap.h>
+#include <pagecache.h>
+#include <swap.h>
+#include <kprof.h>
 
 /*
  * Kernel malloc.
@@ -75,6 +84,15 @@ fill_deadbeef(void *vptr, size_t len)
 //    cannot recursively use the subpage allocator. (We could probably
 //    make that work, but it would be painful.)
 //
+//    To free a block we need the entry for its page. The coremap keeps
+//    a pointer to it for every page it manages, so that is a lookup by
+//    page number. Only the few pages allocated while booting, before
+//    the coremap was set up, have to be searched for; they're kept on
+//    a list of their own. The lists are doubly linked so that a page
+//    can be taken off them without searching either. A pointer that
+//    isn't on any subpage page must be a multi-page allocation, whose
+//    length the coremap knows.
+//
 
 #undef  SLOW	/* consistency checks */
 #undef SLOWER	/* lots of consistency checks */
@@ -103,7 +121,9 @@ struct freelist {
 
 struct pageref {
 	struct pageref *next_samesize;
-	struct pageref *next_all;
+	struct pageref *prev_samesize;
+	struct pageref *next_all;	/* on allbase or bootbase */
+	struct pageref *prev_all;
 	vaddr_t pageaddr_and_blocktype;
 	uint16_t freelist_offset;
 	uint16_t nfree;
@@ -118,85 +138,128 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * This is cheesy. 
- *
- * The problem is not that it's wasteful - we can only allocate whole
- * pages of pageref structures at a time anyway. The problem is that
- * we really ought to be able to have more than one of these pages.
- *
- * However, for the time being, one page worth of pagerefs gives us
- * 256 pagerefs; this lets us manage 256 * 4k = 1M of kernel heap.
- * That would be twice as much memory as we get for *everything*.
- * Thus, we will cheat and not allow any mechanism for having a second
- * page of pageref structs.
+ * Pagerefs come a page at a time, carved up and put on a free list
+ * threaded through next_all, so getting one and giving it back are
+ * both O(1). The first page of them (enough for NPAGEREFS pages, or
+ * about 680k, of heap) is in the kernel BSS, so that kmalloc works
+ * while booting without the VM system; when those run out, another
+ * page is allocated and added. Pages of pagerefs are never given back,
+ * which costs one page per NPAGEREFS pages of heap at its largest.
  *
- * Then, since the size is fixed at one page, we'll simplify a bit
- * further by allocating the page in the kernel BSS instead of calling
- * alloc_kpages to get it.
+ * A free pageref has pageaddr_and_blocktype 0, which catches freeing
+ * one twice.
  */
 
 #define NPAGEREFS (PAGE_SIZE / sizeof(struct pageref))
-static struct pageref pagerefs[NPAGEREFS];
+static struct pageref bootpagerefs[NPAGEREFS];
 
-#define INUSE_WORDS (NPAGEREFS/32)
-static uint32_t pagerefs_inuse[INUSE_WORDS];
+static struct pageref *freepagerefs;
+static bool pagerefs_booted;
+static unsigned npagerefpages;	/* pages of pagerefs, BSS one included */
+static unsigned npagerefsfree;
+
+/*
+ * Put the pagerefs in the page at PAGE on the free list.
+ */
+static
+void
+addpagerefs(struct pageref *page)
+{
+	unsigned i;
+
+	for (i=0; i<NPAGEREFS; i++) {
+		page[i].pageaddr_and_blocktype = 0;
+		page[i].next_all = freepagerefs;
+		freepagerefs = &page[i];
+	}
+	npagerefpages++;
+	npagerefsfree += NPAGEREFS;
+}
 
 static
 struct pageref *
 allocpageref(void)
 {
-	unsigned i,j;
-	uint32_t k;
+	struct pageref *p;
 
-	for (i=0; i<INUSE_WORDS; i++) {
-		if (pagerefs_inuse[i]==0xffffffff) {
-			/* full */
-			continue;
-		}
-		for (k=1,j=0; k!=0; k<<=1,j++) {
-			if ((pagerefs_inuse[i] & k)==0) {
-				pagerefs_inuse[i] |= k;
-				return &pagerefs[i*32 + j];
-			}
-		}
-		KASSERT(0);
+	if (!pagerefs_booted) {
+		addpagerefs(bootpagerefs);
+		pagerefs_booted = true;
 	}
 
-	/* ran out */
-	return NULL;
+	p = freepagerefs;
+	if (p == NULL) {
+		/* ran out */
+		return NULL;
+	}
+	KASSERT(p->pageaddr_and_blocktype == 0);
+	freepagerefs = p->next_all;
+	npagerefsfree--;
+	return p;
 }
 
 static
 void
 freepageref(struct pageref *p)
 {
-	size_t i, j;
-	uint32_t k;
-
-	j = p-pagerefs;
-	KASSERT(j < NPAGEREFS);  /* note: j is unsigned, don't test < 0 */
-	i = j/32;
-	k = ((uint32_t)1) << (j%32);
-	KASSERT((pagerefs_inuse[i] & k) != 0);
-	pagerefs_inuse[i] &= ~k;
+	KASSERT(p->pageaddr_and_blocktype != 0);
+	p->pageaddr_and_blocktype = 0;
+	p->next_all = freepagerefs;
+	freepagerefs = p;
+	npagerefsfree++;
 }
 
 ////////////////////////////////////////
 
 static struct pageref *sizebases[NSIZES];
-static struct pageref *allbase;
+static struct pageref *allbase;		/* pages the coremap knows */
+static struct pageref *bootbase;	/* pages from before the coremap */
 
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * Use one spinlock for the pages and their freelists. Most allocations
+ * and frees don't get this far, though; see the per-cpu magazines
+ * below.
  */
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
 
+////////////////////////////////////////
+//
+// Per-cpu magazines.
+//
+//    Each cpu keeps, for each block size, a small stack of free blocks
+//    (a "magazine") that kmalloc and kfree use without taking
+//    kmalloc_spinlock. Each cpu's magazines have a spinlock of their
+//    own, which only that cpu takes, except when kheap_drain empties
+//    them all; so it costs no contention. Holding it also keeps the
+//    thread from moving to another cpu meanwhile. As far as their
+//    pages are concerned, blocks in a magazine are still allocated.
+//
+//    When a magazine runs dry, kmalloc refills it with KMAG_BATCH
+//    blocks from the pages in one go; when one is full, kfree sends
+//    KMAG_BATCH blocks back. So the shared lock is taken about once
+//    every KMAG_BATCH allocations of a size instead of every time.
+//
+//    kfree needs to know the size of a block to put it in the right
+//    magazine. It gets it from the block's pageref, which the coremap
+//    keeps for every page the subpage allocator owns. Pages allocated
+//    before the coremap was set up aren't known there; their blocks
+//    are freed the old way.
+//
+
+#define KMAG_SIZE  16			/* blocks in a full magazine */
+#define KMAG_BATCH (KMAG_SIZE / 2)	/* blocks moved at a time */
+
+struct kmag {
+	struct freelist *km_blocks;
+	unsigned km_count;
+};
+
+static struct kmag kmags[MAXCPUS][NSIZES];
+static struct spinlock kmaglocks[MAXCPUS];	/* all-zero is unlocked */
+
 ////////////////////////////////////////
 
 /* SLOWER implies SLOW */
@@ -260,18 +323,29 @@ checksubpages(void)
 	for (i=0; i<NSIZES; i++) {
 		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
 			checksubpage(pr);
-			KASSERT(sc < NPAGEREFS);
+			KASSERT(pr->next_samesize == NULL ||
+				pr->next_samesize->prev_samesize == pr);
+			KASSERT(sc < npagerefpages * NPAGEREFS);
 			sc++;
 		}
 	}
 
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
 		checksubpage(pr);
-		KASSERT(ac < NPAGEREFS);
+		KASSERT(coremap_heap(PR_PAGEADDR(pr) - MIPS_KSEG0) == pr);
+		KASSERT(pr->next_all == NULL || pr->next_all->prev_all == pr);
+		KASSERT(ac < npagerefpages * NPAGEREFS);
+		ac++;
+	}
+	for (pr = bootbase; pr != NULL; pr = pr->next_all) {
+		checksubpage(pr);
+		KASSERT(pr->next_all == NULL || pr->next_all->prev_all == pr);
+		KASSERT(ac < npagerefpages * NPAGEREFS);
 		ac++;
 	}
 
 	KASSERT(sc==ac);
+	KASSERT(ac + npagerefsfree == npagerefpages * NPAGEREFS);
 }
 #else
 #define checksubpages() 
@@ -330,48 +404,140 @@ dumpsubpage(struct pageref *pr)
 	kprintf("\n");
 }
 
+/*
+ * Magazine hit rate, and how many blocks the magazines are holding.
+ * Unlocked; the numbers can be a little stale.
+ */
+static
+void
+kmag_printstats(void)
+{
+	unsigned cached, i, j;
+
+	cached = 0;
+	for (i=0; i<MAXCPUS; i++) {
+		for (j=0; j<NSIZES; j++) {
+			cached += kmags[i][j].km_count;
+		}
+	}
+	kprintf("magazines: %u hits, %u misses, %u blocks cached\n",
+		cpustat_get(CPUSTAT_KMAGHIT), cpustat_get(CPUSTAT_KMAGMISS),
+		cached);
+}
+
 void
 kheap_printstats(void)
 {
 	struct pageref *pr;
 
+	/* Otherwise blocks sitting in magazines look allocated. */
+	kheap_drain();
+
 	/* print the whole thing with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
 
-	kprintf("Subpage allocator status:\n");
+	kprintf("Subpage allocator status: %u pages of pagerefs, "
+		"%u pagerefs free\n", npagerefpages, npagerefsfree);
 
+	for (pr = bootbase; pr != NULL; pr = pr->next_all) {
+		dumpsubpage(pr);
+	}
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
 		dumpsubpage(pr);
 	}
 
 	spinlock_release(&kmalloc_spinlock);
+
+	kprintf("kmalloc: %u calls, kfree: %u calls\n",
+		cpustat_get(CPUSTAT_KMALLOC), cpustat_get(CPUSTAT_KFREE));
+	kmag_printstats();
+	coremap_printstats();
+	pagecache_printstats();
+	swap_printstats();
 }
 
 ////////////////////////////////////////
 
 static
 void
-remove_lists(struct pageref *pr, int blktype)
+add_lists(struct pageref *pr, int blktype, struct pageref **base)
 {
-	struct pageref **guy;
+	KASSERT(blktype>=0 && blktype<NSIZES);
 
+	pr->prev_samesize = NULL;
+	pr->next_samesize = sizebases[blktype];
+	if (pr->next_samesize != NULL) {
+		pr->next_samesize->prev_samesize = pr;
+	}
+	sizebases[blktype] = pr;
+
+	pr->prev_all = NULL;
+	pr->next_all = *base;
+	if (pr->next_all != NULL) {
+		pr->next_all->prev_all = pr;
+	}
+	*base = pr;
+}
+
+static
+void
+remove_lists(struct pageref *pr, int blktype)
+{
 	KASSERT(blktype>=0 && blktype<NSIZES);
+	checksubpage(pr);
 
-	for (guy = &sizebases[blktype]; *guy; guy = &(*guy)->next_samesize) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_samesize;
-			break;
-		}
+	if (pr->prev_samesize != NULL) {
+		pr->prev_samesize->next_samesize = pr->next_samesize;
+	}
+	else {
+		KASSERT(sizebases[blktype] == pr);
+		sizebases[blktype] = pr->next_samesize;
+	}
+	if (pr->next_samesize != NULL) {
+		pr->next_samesize->prev_samesize = pr->prev_samesize;
 	}
 
-	for (guy = &allbase; *guy; guy = &(*guy)->next_all) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_all;
-			break;
+	if (pr->prev_all != NULL) {
+		pr->prev_all->next_all = pr->next_all;
+	}
+	else if (allbase == pr) {
+		allbase = pr->next_all;
+	}
+	else {
+		KASSERT(bootbase == pr);
+		bootbase = pr->next_all;
+	}
+	if (pr->next_all != NULL) {
+		pr->next_all->prev_all = pr->prev_all;
+	}
+}
+
+/*
+ * Find the pageref for the page PTRADDR is on, or NULL if it isn't on
+ * a subpage page.
+ */
+static
+struct pageref *
+findpageref(vaddr_t ptraddr)
+{
+	struct pageref *pr;
+	vaddr_t prpage;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	pr = coremap_heap(ptraddr - MIPS_KSEG0);
+	if (pr != NULL) {
+		KASSERT(PR_PAGEADDR(pr) == (ptraddr & PAGE_FRAME));
+		return pr;
+	}
+
+	for (pr = bootbase; pr != NULL; pr = pr->next_all) {
+		prpage = PR_PAGEADDR(pr);
+		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
+			return pr;
 		}
 	}
+	return NULL;
 }
 
 static
@@ -392,6 +558,284 @@ int blocktype(size_t sz)
 	return 0;
 }
 
+/*
+ * Take a block off the freelist of PR, which must have one.
+ */
+static
+void *
+subpage_takeblock(struct pageref *pr)
+{
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *fl;	// free list entry
+	void *retptr;		// our result
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(pr->nfree > 0);
+	KASSERT(pr->freelist_offset < PAGE_SIZE);
+
+	prpage = PR_PAGEADDR(pr);
+	fla = prpage + pr->freelist_offset;
+	fl = (struct freelist *)fla;
+
+	retptr = fl;
+	fl = fl->next;
+	pr->nfree--;
+
+	if (fl != NULL) {
+		KASSERT(pr->nfree > 0);
+		fla = (vaddr_t)fl;
+		KASSERT(fla - prpage < PAGE_SIZE);
+		pr->freelist_offset = fla - prpage;
+	}
+	else {
+		KASSERT(pr->nfree == 0);
+		pr->freelist_offset = INVALID_OFFSET;
+	}
+
+	return retptr;
+}
+
+/*
+ * Put the block at OFFSET back on the freelist of PR. If that makes
+ * the whole page free, take the page off the lists and return true;
+ * the caller then hands it back with free_kpages, after releasing
+ * kmalloc_spinlock.
+ */
+static
+bool
+subpage_putblock(struct pageref *pr, vaddr_t offset)
+{
+	int blktype;		// index into sizes[] that we're using
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	struct freelist *fl;	// free list entry
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+
+	/*
+	 * We probably ought to check for free twice by seeing if the block
+	 * is already on the free list. But that's expensive, so we don't.
+	 */
+
+	fl = (struct freelist *)(prpage + offset);
+	if (pr->freelist_offset == INVALID_OFFSET) {
+		fl->next = NULL;
+	} else {
+		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
+	}
+	pr->freelist_offset = offset;
+	pr->nfree++;
+
+	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
+	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
+		/* Whole page is free. */
+		remove_lists(pr, blktype);
+		freepageref(pr);
+		coremap_setheap(prpage - MIPS_KSEG0, NULL);
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Refill the empty magazine MAG with up to KMAG_BATCH blocks of type
+ * BLKTYPE from the pages that have some free. New pages aren't made
+ * here; if there are no free blocks, the magazine stays empty and the
+ * caller goes the long way round.
+ */
+static
+void
+kmag_refill(struct kmag *mag, unsigned blktype)
+{
+	struct pageref *pr;
+	struct freelist *fl;
+
+	KASSERT(mag->km_count == 0);
+
+	spinlock_acquire(&kmalloc_spinlock);
+	checksubpages();
+
+	for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
+		KASSERT(PR_BLOCKTYPE(pr) == blktype);
+		while (pr->nfree > 0 && mag->km_count < KMAG_BATCH) {
+			fl = subpage_takeblock(pr);
+			fl->next = mag->km_blocks;
+			mag->km_blocks = fl;
+			mag->km_count++;
+		}
+		if (mag->km_count == KMAG_BATCH) {
+			break;
+		}
+	}
+
+	checksubpages();
+	spinlock_release(&kmalloc_spinlock);
+}
+
+/*
+ * Send N blocks from the magazine MAG back to their pages, and free
+ * any pages that become empty. Returns the number of pages freed.
+ */
+static
+unsigned
+kmag_flush(struct kmag *mag, unsigned n)
+{
+	vaddr_t emptypages[KMAG_SIZE];
+	unsigned nempty, i;
+	struct freelist *fl;
+	struct pageref *pr;
+	vaddr_t fla;
+
+	KASSERT(n <= mag->km_count);
+
+	nempty = 0;
+
+	spinlock_acquire(&kmalloc_spinlock);
+	checksubpages();
+
+	for (i=0; i<n; i++) {
+		fl = mag->km_blocks;
+		mag->km_blocks = fl->next;
+		mag->km_count--;
+
+		fla = (vaddr_t)fl;
+		pr = coremap_heap(fla - MIPS_KSEG0);
+		KASSERT(pr != NULL);
+		if (subpage_putblock(pr, fla - PR_PAGEADDR(pr))) {
+			emptypages[nempty++] = fla & PAGE_FRAME;
+		}
+	}
+
+	checksubpages();
+	spinlock_release(&kmalloc_spinlock);
+
+	for (i=0; i<nempty; i++) {
+		free_kpages(emptypages[i]);
+	}
+	return nempty;
+}
+
+/*
+ * Get a block of type BLKTYPE from this cpu's magazine, refilling it
+ * if it's empty. Returns NULL if there were no free blocks to be had
+ * without making a new page.
+ */
+static
+void *
+kmag_alloc(unsigned blktype)
+{
+	struct kmag *mag;
+	struct freelist *fl;
+	unsigned cpunum;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		return NULL;
+	}
+
+	spl = splhigh();
+	cpunum = curcpu->c_number;
+	spinlock_acquire(&kmaglocks[cpunum]);
+	mag = &kmags[cpunum][blktype];
+	if (mag->km_count > 0) {
+		cpustat_inc(CPUSTAT_KMAGHIT);
+	}
+	else {
+		cpustat_inc(CPUSTAT_KMAGMISS);
+		kmag_refill(mag, blktype);
+		if (mag->km_count == 0) {
+			spinlock_release(&kmaglocks[cpunum]);
+			splx(spl);
+			return NULL;
+		}
+	}
+	fl = mag->km_blocks;
+	mag->km_blocks = fl->next;
+	mag->km_count--;
+	spinlock_release(&kmaglocks[cpunum]);
+	splx(spl);
+
+	return fl;
+}
+
+/*
+ * Put PTR in this cpu's magazine for its size, making room first if
+ * the magazine is full. Returns false if PTR isn't on a page the
+ * coremap knows to be a subpage page.
+ */
+static
+bool
+kmag_free(void *ptr)
+{
+	struct pageref *pr;
+	struct kmag *mag;
+	struct freelist *fl;
+	vaddr_t offset;
+	unsigned cpunum;
+	int blktype;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		return false;
+	}
+	pr = coremap_heap((vaddr_t)ptr - MIPS_KSEG0);
+	if (pr == NULL) {
+		return false;
+	}
+
+	/*
+	 * The page can't go away (or change size) under us, since PTR
+	 * is still allocated on it, so PR can be read without the lock.
+	 */
+	blktype = PR_BLOCKTYPE(pr);
+	KASSERT(blktype>=0 && blktype<NSIZES);
+	offset = (vaddr_t)ptr - PR_PAGEADDR(pr);
+	if (offset >= PAGE_SIZE || offset % sizes[blktype] != 0) {
+		panic("kfree: subpage free of invalid addr %p\n", ptr);
+	}
+
+	fill_deadbeef(ptr, sizes[blktype]);
+
+	spl = splhigh();
+	cpunum = curcpu->c_number;
+	spinlock_acquire(&kmaglocks[cpunum]);
+	mag = &kmags[cpunum][blktype];
+	if (mag->km_count < KMAG_SIZE) {
+		cpustat_inc(CPUSTAT_KMAGHIT);
+	}
+	else {
+		cpustat_inc(CPUSTAT_KMAGMISS);
+		kmag_flush(mag, KMAG_BATCH);
+	}
+	fl = ptr;
+	fl->next = mag->km_blocks;
+	mag->km_blocks = fl;
+	mag->km_count++;
+	spinlock_release(&kmaglocks[cpunum]);
+	splx(spl);
+
+	return true;
+}
+
+unsigned
+kheap_drain(void)
+{
+	unsigned i, j, n;
+
+	n = 0;
+	for (i=0; i<MAXCPUS; i++) {
+		spinlock_acquire(&kmaglocks[i]);
+		for (j=0; j<NSIZES; j++) {
+			n += kmag_flush(&kmags[i][j], kmags[i][j].km_count);
+		}
+		spinlock_release(&kmaglocks[i]);
+	}
+	return n;
+}
+
 static
 void *
 subpage_kmalloc(size_t sz)
@@ -402,6 +846,7 @@ subpage_kmalloc(size_t sz)
 	vaddr_t fla;		// free list entry address
 	struct freelist *volatile fl;	// free list entry
 	void *retptr;		// our result
+	vaddr_t refpage;	// new page of pagerefs
 
 	volatile int i;
 
@@ -409,6 +854,11 @@ subpage_kmalloc(size_t sz)
 	blktype = blocktype(sz);
 	sz = sizes[blktype];
 
+	retptr = kmag_alloc(blktype);
+	if (retptr != NULL) {
+		return retptr;
+	}
+
 	spinlock_acquire(&kmalloc_spinlock);
 
 	checksubpages();
@@ -423,25 +873,7 @@ subpage_kmalloc(size_t sz)
 
 		doalloc: /* comes here after getting a whole fresh page */
 
-			KASSERT(pr->freelist_offset < PAGE_SIZE);
-			prpage = PR_PAGEADDR(pr);
-			fla = prpage + pr->freelist_offset;
-			fl = (struct freelist *)fla;
-
-			retptr = fl;
-			fl = fl->next;
-			pr->nfree--;
-
-			if (fl != NULL) {
-				KASSERT(pr->nfree > 0);
-				fla = (vaddr_t)fl;
-				KASSERT(fla - prpage < PAGE_SIZE);
-				pr->freelist_offset = fla - prpage;
-			}
-			else {
-				KASSERT(pr->nfree == 0);
-				pr->freelist_offset = INVALID_OFFSET;
-			}
+			retptr = subpage_takeblock(pr);
 
 			checksubpages();
 
@@ -470,11 +902,21 @@ subpage_kmalloc(size_t sz)
 
 	pr = allocpageref();
 	if (pr==NULL) {
-		/* Couldn't allocate accounting space for the new page. */
+		/*
+		 * Out of pagerefs; get another page of them, again
+		 * without the spinlock.
+		 */
 		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
-		kprintf("kmalloc: Subpage allocator couldn't get pageref\n"); 
-		return NULL;
+		refpage = alloc_kpages(1);
+		if (refpage==0) {
+			free_kpages(prpage);
+			kprintf("kmalloc: Subpage allocator couldn't get pageref\n"); 
+			return NULL;
+		}
+		spinlock_acquire(&kmalloc_spinlock);
+		addpagerefs((struct pageref *)refpage);
+		pr = allocpageref();
+		KASSERT(pr != NULL);
 	}
 
 	pr->pageaddr_and_blocktype = MKPAB(prpage, blktype);
@@ -498,11 +940,14 @@ subpage_kmalloc(size_t sz)
 	pr->freelist_offset = fla - prpage;
 	KASSERT(pr->freelist_offset == (pr->nfree-1)*sizes[blktype]);
 
-	pr->next_samesize = sizebases[blktype];
-	sizebases[blktype] = pr;
-
-	pr->next_all = allbase;
-	allbase = pr;
+	/* Let kfree find the pageref, if the coremap is up. */
+	coremap_setheap(prpage - MIPS_KSEG0, pr);
+	if (coremap_heap(prpage - MIPS_KSEG0) == pr) {
+		add_lists(pr, blktype, &allbase);
+	}
+	else {
+		add_lists(pr, blktype, &bootbase);
+	}
 
 	/* This is kind of cheesy, but avoids duplicating the alloc code. */
 	goto doalloc;
@@ -516,9 +961,8 @@ subpage_kfree(void *ptr)
 	vaddr_t ptraddr;	// same as ptr
 	struct pageref *pr;	// pageref for page we're freeing in
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
-	vaddr_t fla;		// free list entry address
-	struct freelist *fl;	// free list entry
 	vaddr_t offset;		// offset into page
+	bool pagefree;		// page is now all free
 
 	ptraddr = (vaddr_t)ptr;
 
@@ -526,25 +970,20 @@ subpage_kfree(void *ptr)
 
 	checksubpages();
 
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
-	}
-
+	pr = findpageref(ptraddr);
 	if (pr==NULL) {
 		/* Not on any of our pages - not a subpage allocation */
 		spinlock_release(&kmalloc_spinlock);
 		return -1;
 	}
 
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+
+	/* check for corruption */
+	KASSERT(blktype>=0 && blktype<NSIZES);
+	checksubpage(pr);
+
 	offset = ptraddr - prpage;
 
 	/* Check for proper positioning and alignment */
@@ -558,33 +997,13 @@ subpage_kfree(void *ptr)
 	 */
 	fill_deadbeef(ptr, sizes[blktype]);
 
-	/*
-	 * We probably ought to check for free twice by seeing if the block
-	 * is already on the free list. But that's expensive, so we don't.
-	 */
-
-	fla = prpage + offset;
-	fl = (struct freelist *)fla;
-	if (pr->freelist_offset == INVALID_OFFSET) {
-		fl->next = NULL;
-	} else {
-		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
-	}
-	pr->freelist_offset = offset;
-	pr->nfree++;
+	pagefree = subpage_putblock(pr, offset);
 
-	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
-	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
-		/* Whole page is free. */
-		remove_lists(pr, blktype);
-		freepageref(pr);
-		/* Call free_kpages without kmalloc_spinlock. */
-		spinlock_release(&kmalloc_spinlock);
+	/* Call free_kpages without kmalloc_spinlock. */
+	spinlock_release(&kmalloc_spinlock);
+	if (pagefree) {
 		free_kpages(prpage);
 	}
-	else {
-		spinlock_release(&kmalloc_spinlock);
-	}
 
 #ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
 	spinlock_acquire(&kmalloc_spinlock);
@@ -599,8 +1018,11 @@ subpage_kfree(void *ptr)
 ////////////////////////////////////////////////////////////
 
 void *
-kmalloc(size_t sz)
+kmalloc_at(size_t sz, const char *file)
 {
+	void *ptr;
+
+	cpustat_inc(CPUSTAT_KMALLOC);
 	if (sz>=LARGEST_SUBPAGE_SIZE) {
 		unsigned long npages;
 		vaddr_t address;
@@ -612,10 +1034,17 @@ kmalloc(size_t sz)
 			return NULL;
 		}
 
-		return (void *)address;
+		ptr = (void *)address;
+	}
+	else {
+		ptr = subpage_kmalloc(sz);
 	}
 
-	return subpage_kmalloc(sz);
+	if (kprof_on && ptr != NULL) {
+		kprof_alloc(ptr, sz, (vaddr_t)__builtin_return_address(0),
+			    file);
+	}
+	return ptr;
 }
 
 void
@@ -626,7 +1055,15 @@ kfree(void *ptr)
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+	cpustat_inc(CPUSTAT_KFREE);
+	if (kprof_on) {
+		kprof_free(ptr);
+	}
+	if (kmag_free(ptr)) {
+		return;
+	}
+	if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
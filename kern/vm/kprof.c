@@ -0,0 +1,515 @@
+/*
+ * Kernel heap profiler.
+ *
+ * Call sites live in a small open-addressed hash table keyed by return
+ * address; when it fills up, further sites are lumped together in one
+ * extra entry. Live blocks live in a bigger one keyed by address,
+ * which is kept no more than 3/4 full so probes stay short, and
+ * entries are deleted by moving later ones back rather than with
+ * tombstones. Both tables come straight from alloc_kpages when
+ * profiling is turned on, since kmalloc can't be used to keep track
+ * of kmalloc. Everything is under one spinlock, which every kmalloc
+ * and kfree takes while profiling is on; so the reports copy what they
+ * print to scratch space under it and print after letting go.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <clock.h>
+#include <vm.h>
+#include <kprof.h>
+
+#define KPROF_NSITES    256		/* hashed call sites */
+#define KPROF_OTHER     KPROF_NSITES	/* ...and where the rest go */
+#define KPROF_BLOCKBITS 13
+#define KPROF_NBLOCKS   (1 << KPROF_BLOCKBITS)
+#define KPROF_MAXLIVE   (KPROF_NBLOCKS / 4 * 3)
+#define KPROF_NTOP      20		/* sites kprof_print shows */
+#define KPROF_NSUBSYS   24		/* subsystems kprof_print adds up */
+#define KPROF_NAMELEN   24		/* ...and how much of their names */
+
+#define KPROF_SITEHASH(pc)   (((pc) >> 2) % KPROF_NSITES)
+#define KPROF_BLOCKHASH(a) \
+	((((uint32_t)(a) >> 4) * 2654435761U) >> (32 - KPROF_BLOCKBITS))
+
+struct kprof_site {
+	vaddr_t ks_pc;			/* return address; 0 if unused */
+	const char *ks_file;		/* source file of the call */
+	uint32_t ks_allocs;		/* allocations made */
+	uint32_t ks_frees;		/* ...and freed again */
+	uint32_t ks_live;		/* bytes allocated now */
+	uint32_t ks_peak;		/* most ks_live has been */
+	uint32_t ks_liveblocks;		/* blocks allocated now */
+	uint32_t ks_leaked;		/* scratch for kprof_leaks */
+};
+
+struct kprof_block {
+	vaddr_t kb_addr;		/* 0 if the slot is empty */
+	uint32_t kb_size;
+	uint16_t kb_site;
+	uint16_t kb_gen;		/* generation allocated in */
+};
+
+#define KPROF_SITEPAGES \
+	DIVROUNDUP((KPROF_NSITES + 1) * sizeof(struct kprof_site), PAGE_SIZE)
+#define KPROF_BLOCKPAGES \
+	DIVROUNDUP(KPROF_NBLOCKS * sizeof(struct kprof_block), PAGE_SIZE)
+
+volatile bool kprof_on;
+
+static struct spinlock kprof_lock = SPINLOCK_INITIALIZER;
+static struct kprof_site *kp_sites;
+static struct kprof_block *kp_blocks;
+static unsigned kp_nblocks;		/* blocks in kp_blocks */
+static unsigned kp_untracked;		/* allocations there was no room for */
+static uint16_t kp_gen;			/* current generation */
+static time_t kp_startsecs;		/* when profiling was turned on */
+
+/*
+ * Scratch space for kprof_print and kprof_leaks, too big for the
+ * stack. In use while kp_printing is set.
+ */
+static bool kp_printing;
+static uint16_t kp_order[KPROF_NSITES + 1];
+static struct kprof_site kp_snap[KPROF_NSITES + 1];
+static struct {
+	char name[KPROF_NAMELEN];
+	uint32_t live;
+	uint32_t allocs;
+} kp_subsys[KPROF_NSUBSYS];
+
+int
+kprof_start(void)
+{
+	vaddr_t sites, blocks;
+	uint32_t nsecs;
+
+	sites = alloc_kpages(KPROF_SITEPAGES);
+	if (sites == 0) {
+		return ENOMEM;
+	}
+	blocks = alloc_kpages(KPROF_BLOCKPAGES);
+	if (blocks == 0) {
+		free_kpages(sites);
+		return ENOMEM;
+	}
+	bzero((void *)sites, KPROF_SITEPAGES * PAGE_SIZE);
+	bzero((void *)blocks, KPROF_BLOCKPAGES * PAGE_SIZE);
+
+	spinlock_acquire(&kprof_lock);
+	if (kp_blocks != NULL) {
+		spinlock_release(&kprof_lock);
+		free_kpages(blocks);
+		free_kpages(sites);
+		return EBUSY;
+	}
+	kp_sites = (struct kprof_site *)sites;
+	kp_blocks = (struct kprof_block *)blocks;
+	kp_nblocks = 0;
+	kp_untracked = 0;
+	kp_gen = 1;
+	gettime(&kp_startsecs, &nsecs);
+	kprof_on = true;
+	spinlock_release(&kprof_lock);
+
+	return 0;
+}
+
+void
+kprof_stop(void)
+{
+	struct kprof_site *sites;
+	struct kprof_block *blocks;
+
+	spinlock_acquire(&kprof_lock);
+	kprof_on = false;
+	sites = kp_sites;
+	blocks = kp_blocks;
+	kp_sites = NULL;
+	kp_blocks = NULL;
+	spinlock_release(&kprof_lock);
+
+	if (blocks != NULL) {
+		free_kpages((vaddr_t)blocks);
+		free_kpages((vaddr_t)sites);
+	}
+}
+
+/*
+ * Find (or make) the entry for the call site PC in FILE.
+ */
+static
+unsigned
+kprof_findsite(vaddr_t pc, const char *file)
+{
+	struct kprof_site *ks;
+	unsigned i, n;
+
+	KASSERT(spinlock_do_i_hold(&kprof_lock));
+	KASSERT(pc != 0);
+
+	i = KPROF_SITEHASH(pc);
+	for (n=0; n<KPROF_NSITES; n++) {
+		ks = &kp_sites[i];
+		if (ks->ks_pc == pc) {
+			return i;
+		}
+		if (ks->ks_pc == 0) {
+			ks->ks_pc = pc;
+			ks->ks_file = file;
+			return i;
+		}
+		i = (i + 1) % KPROF_NSITES;
+	}
+	return KPROF_OTHER;
+}
+
+void
+kprof_alloc(void *ptr, size_t size, vaddr_t pc, const char *file)
+{
+	struct kprof_site *ks;
+	struct kprof_block *kb;
+	unsigned site, i;
+
+	spinlock_acquire(&kprof_lock);
+	if (kp_blocks == NULL) {
+		/* turned off meanwhile */
+		spinlock_release(&kprof_lock);
+		return;
+	}
+
+	site = kprof_findsite(pc, file);
+	ks = &kp_sites[site];
+	ks->ks_allocs++;
+
+	if (kp_nblocks >= KPROF_MAXLIVE) {
+		kp_untracked++;
+		spinlock_release(&kprof_lock);
+		return;
+	}
+
+	i = KPROF_BLOCKHASH(ptr);
+	while (kp_blocks[i].kb_addr != 0) {
+		KASSERT(kp_blocks[i].kb_addr != (vaddr_t)ptr);
+		i = (i + 1) % KPROF_NBLOCKS;
+	}
+	kb = &kp_blocks[i];
+	kb->kb_addr = (vaddr_t)ptr;
+	kb->kb_size = size;
+	kb->kb_site = site;
+	kb->kb_gen = kp_gen;
+	kp_nblocks++;
+
+	ks->ks_live += size;
+	ks->ks_liveblocks++;
+	if (ks->ks_live > ks->ks_peak) {
+		ks->ks_peak = ks->ks_live;
+	}
+
+	spinlock_release(&kprof_lock);
+}
+
+/*
+ * Empty slot I of the block table, moving back any entries after it
+ * that would no longer be found past the gap.
+ */
+static
+void
+kprof_delete(unsigned i)
+{
+	unsigned j, home;
+
+	KASSERT(spinlock_do_i_hold(&kprof_lock));
+
+	j = i;
+	while (1) {
+		j = (j + 1) % KPROF_NBLOCKS;
+		if (kp_blocks[j].kb_addr == 0) {
+			break;
+		}
+		home = KPROF_BLOCKHASH(kp_blocks[j].kb_addr);
+		/* Leave it if its home is cyclically in (i, j]. */
+		if (i <= j ? (home > i && home <= j) :
+		    (home > i || home <= j)) {
+			continue;
+		}
+		kp_blocks[i] = kp_blocks[j];
+		i = j;
+	}
+	kp_blocks[i].kb_addr = 0;
+}
+
+void
+kprof_free(void *ptr)
+{
+	struct kprof_site *ks;
+	struct kprof_block *kb;
+	unsigned i;
+
+	spinlock_acquire(&kprof_lock);
+	if (kp_blocks == NULL) {
+		spinlock_release(&kprof_lock);
+		return;
+	}
+
+	i = KPROF_BLOCKHASH(ptr);
+	while (kp_blocks[i].kb_addr != (vaddr_t)ptr) {
+		if (kp_blocks[i].kb_addr == 0) {
+			/* allocated before we started, or not tracked */
+			spinlock_release(&kprof_lock);
+			return;
+		}
+		i = (i + 1) % KPROF_NBLOCKS;
+	}
+
+	kb = &kp_blocks[i];
+	ks = &kp_sites[kb->kb_site];
+	KASSERT(ks->ks_liveblocks > 0 && ks->ks_live >= kb->kb_size);
+	ks->ks_live -= kb->kb_size;
+	ks->ks_liveblocks--;
+	ks->ks_frees++;
+
+	kprof_delete(i);
+	kp_nblocks--;
+
+	spinlock_release(&kprof_lock);
+}
+
+void
+kprof_nextgen(void)
+{
+	spinlock_acquire(&kprof_lock);
+	kp_gen++;
+	spinlock_release(&kprof_lock);
+}
+
+/*
+ * FILE without the leading ../ the build puts on it.
+ */
+static
+const char *
+kprof_path(const char *file)
+{
+	if (file == NULL) {
+		return "(other)";
+	}
+	while (file[0] == '.') {
+		if (file[1] == '/') {
+			file += 2;
+		}
+		else if (file[1] == '.' && file[2] == '/') {
+			file += 3;
+		}
+		else {
+			break;
+		}
+	}
+	return file;
+}
+
+/*
+ * Put the directory part of PATH, which is the subsystem, in NAME.
+ */
+static
+void
+kprof_subsys(const char *path, char *name)
+{
+	const char *slash;
+	size_t len;
+
+	slash = strrchr(path, '/');
+	if (slash == NULL) {
+		strcpy(name, "-");
+		return;
+	}
+	len = slash - path;
+	if (len >= KPROF_NAMELEN) {
+		len = KPROF_NAMELEN - 1;
+	}
+	memcpy(name, path, len);
+	name[len] = 0;
+}
+
+static
+void
+kprof_printsite(const struct kprof_site *ks)
+{
+	if (ks->ks_pc == 0) {
+		kprintf("%-10s ", "other");
+	}
+	else {
+		kprintf("0x%08lx ", (unsigned long)ks->ks_pc);
+	}
+	kprintf("%-26s", kprof_path(ks->ks_file));
+}
+
+/*
+ * Start a report: lock, and claim the scratch space. Returns false,
+ * having said why, if there's nothing to report or another report is
+ * using it.
+ */
+static
+bool
+kprof_startreport(void)
+{
+	spinlock_acquire(&kprof_lock);
+	if (kp_sites == NULL) {
+		spinlock_release(&kprof_lock);
+		kprintf("Heap profiling is off\n");
+		return false;
+	}
+	if (kp_printing) {
+		spinlock_release(&kprof_lock);
+		kprintf("Heap profile is being printed already\n");
+		return false;
+	}
+	kp_printing = true;
+	return true;
+}
+
+void
+kprof_print(void)
+{
+	char name[KPROF_NAMELEN];
+	unsigned nsites, ntop, nsubsys, nblocks, untracked, gen, i, j;
+	struct kprof_site *ks;
+	time_t secs;
+	uint32_t nsecs;
+
+	if (!kprof_startreport()) {
+		return;
+	}
+
+	gettime(&secs, &nsecs);
+	secs -= kp_startsecs;
+	if (secs == 0) {
+		secs = 1;
+	}
+
+	/* Sort the sites in use by live bytes, biggest first. */
+	nsites = 0;
+	for (i=0; i<=KPROF_NSITES; i++) {
+		if (kp_sites[i].ks_allocs == 0) {
+			continue;
+		}
+		for (j=nsites; j>0 && kp_sites[kp_order[j-1]].ks_live <
+			     kp_sites[i].ks_live; j--) {
+			kp_order[j] = kp_order[j-1];
+		}
+		kp_order[j] = i;
+		nsites++;
+	}
+
+	/* Take copies of the top ones... */
+	ntop = nsites < KPROF_NTOP ? nsites : KPROF_NTOP;
+	for (i=0; i<ntop; i++) {
+		kp_snap[i] = kp_sites[kp_order[i]];
+	}
+
+	/* ...and add up by subsystem. */
+	nsubsys = 0;
+	for (i=0; i<nsites; i++) {
+		ks = &kp_sites[kp_order[i]];
+		kprof_subsys(kprof_path(ks->ks_file), name);
+		for (j=0; j<nsubsys; j++) {
+			if (!strcmp(kp_subsys[j].name, name)) {
+				break;
+			}
+		}
+		if (j == nsubsys) {
+			if (nsubsys == KPROF_NSUBSYS) {
+				continue;
+			}
+			strcpy(kp_subsys[j].name, name);
+			kp_subsys[j].live = 0;
+			kp_subsys[j].allocs = 0;
+			nsubsys++;
+		}
+		kp_subsys[j].live += ks->ks_live;
+		kp_subsys[j].allocs += ks->ks_allocs;
+	}
+
+	gen = kp_gen;
+	nblocks = kp_nblocks;
+	untracked = kp_untracked;
+	spinlock_release(&kprof_lock);
+
+	kprintf("Heap profile: generation %u, %u blocks tracked, "
+		"%u untracked, %lu seconds\n", gen, nblocks,
+		untracked, (unsigned long)secs);
+	kprintf("%-10s %-26s %8s %6s %8s %8s %6s\n", "site", "file",
+		"live", "blocks", "peak", "allocs", "/sec");
+	for (i=0; i<ntop; i++) {
+		ks = &kp_snap[i];
+		kprof_printsite(ks);
+		kprintf(" %8u %6u %8u %8u %6u\n", ks->ks_live,
+			ks->ks_liveblocks, ks->ks_peak, ks->ks_allocs,
+			ks->ks_allocs / (uint32_t)secs);
+	}
+	if (nsites > ntop) {
+		kprintf("(%u more sites)\n", nsites - ntop);
+	}
+
+	kprintf("%-24s %8s %8s\n", "subsystem", "live", "allocs");
+	for (j=0; j<nsubsys; j++) {
+		kprintf("%-24s %8u %8u\n", kp_subsys[j].name,
+			kp_subsys[j].live, kp_subsys[j].allocs);
+	}
+
+	spinlock_acquire(&kprof_lock);
+	kp_printing = false;
+	spinlock_release(&kprof_lock);
+}
+
+void
+kprof_leaks(void)
+{
+	uint16_t gen;
+	unsigned i, nleaked, nsites;
+	uint32_t bytes;
+
+	if (!kprof_startreport()) {
+		return;
+	}
+	if (kp_gen == 1) {
+		kp_printing = false;
+		spinlock_release(&kprof_lock);
+		kprintf("No previous generation yet\n");
+		return;
+	}
+	gen = kp_gen - 1;
+
+	for (i=0; i<=KPROF_NSITES; i++) {
+		kp_sites[i].ks_leaked = 0;
+	}
+	nleaked = 0;
+	bytes = 0;
+	for (i=0; i<KPROF_NBLOCKS; i++) {
+		if (kp_blocks[i].kb_addr != 0 && kp_blocks[i].kb_gen == gen) {
+			kp_sites[kp_blocks[i].kb_site].ks_leaked +=
+				kp_blocks[i].kb_size;
+			nleaked++;
+			bytes += kp_blocks[i].kb_size;
+		}
+	}
+	nsites = 0;
+	for (i=0; i<=KPROF_NSITES; i++) {
+		if (kp_sites[i].ks_leaked > 0) {
+			kp_snap[nsites++] = kp_sites[i];
+		}
+	}
+	spinlock_release(&kprof_lock);
+
+	kprintf("Still allocated from generation %u: %u blocks, %u bytes\n",
+		gen, nleaked, bytes);
+	for (i=0; i<nsites; i++) {
+		kprof_printsite(&kp_snap[i]);
+		kprintf(" %8u bytes\n", kp_snap[i].ks_leaked);
+	}
+
+	spinlock_acquire(&kprof_lock);
+	kp_printing = false;
+	spinlock_release(&kprof_lock);
+}
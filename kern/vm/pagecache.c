@@ -0,0 +1,249 @@
+/*
+ * Page cache for read-only file pages.
+ *
+ * A fixed-size hash table of chains, keyed by vnode and offset, all
+ * under one spinlock. Entries are only ever dropped with the lock
+ * released and the entry already unlinked, because dropping the
+ * vnode reference can sleep.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vnode.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagecache.h>
+
+#define PC_NBUCKETS  256
+
+struct pc_entry {
+	struct vnode *pce_vnode;
+	off_t pce_offset;
+	off_t pce_fstart;
+	off_t pce_fend;
+	paddr_t pce_paddr;
+	struct pc_entry *pce_next;
+};
+
+static struct pc_entry *pc_table[PC_NBUCKETS];
+static unsigned pc_npages;
+static unsigned pc_hits;
+static unsigned pc_misses;
+
+/* Protects everything above. */
+static struct spinlock pc_lock = SPINLOCK_INITIALIZER;
+
+static
+unsigned
+pc_hash(struct vnode *v, off_t offset)
+{
+	uint32_t h;
+
+	h = (uint32_t)(uintptr_t)v / sizeof(struct vnode);
+	h = h * 31 + (uint32_t)(offset / PAGE_SIZE);
+	return h % PC_NBUCKETS;
+}
+
+static
+struct pc_entry *
+pc_find(struct vnode *v, off_t offset, off_t fstart, off_t fend)
+{
+	struct pc_entry *pce;
+
+	KASSERT(spinlock_do_i_hold(&pc_lock));
+
+	for (pce = pc_table[pc_hash(v, offset)]; pce != NULL;
+	     pce = pce->pce_next) {
+		if (pce->pce_vnode == v && pce->pce_offset == offset &&
+		    pce->pce_fstart == fstart && pce->pce_fend == fend) {
+			return pce;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Drop the cache's references held by the unlinked entries on LIST.
+ */
+static
+void
+pc_droplist(struct pc_entry *list)
+{
+	struct pc_entry *pce;
+
+	while ((pce = list) != NULL) {
+		list = pce->pce_next;
+		coremap_free(pce->pce_paddr);
+		VOP_DECREF(pce->pce_vnode);
+		kfree(pce);
+	}
+}
+
+void
+pagecache_bootstrap(void)
+{
+	unsigned i;
+
+	for (i = 0; i < PC_NBUCKETS; i++) {
+		pc_table[i] = NULL;
+	}
+	pc_npages = pc_hits = pc_misses = 0;
+}
+
+paddr_t
+pagecache_lookup(struct vnode *v, off_t offset, off_t fstart, off_t fend)
+{
+	struct pc_entry *pce;
+	paddr_t paddr;
+
+	spinlock_acquire(&pc_lock);
+	pce = pc_find(v, offset, fstart, fend);
+	if (pce == NULL) {
+		pc_misses++;
+		spinlock_release(&pc_lock);
+		return 0;
+	}
+	paddr = pce->pce_paddr;
+	coremap_incref(paddr);
+	pc_hits++;
+	spinlock_release(&pc_lock);
+	return paddr;
+}
+
+paddr_t
+pagecache_insert(struct vnode *v, off_t offset, off_t fstart, off_t fend,
+		 paddr_t paddr)
+{
+	struct pc_entry *pce, *old;
+	unsigned h;
+
+	/* Allocate first; we can't with the spinlock held. */
+	pce = kmalloc(sizeof(struct pc_entry));
+
+	spinlock_acquire(&pc_lock);
+	old = pc_find(v, offset, fstart, fend);
+	if (old != NULL) {
+		/* Lost the race to read it in. */
+		coremap_incref(old->pce_paddr);
+		paddr = old->pce_paddr;
+		spinlock_release(&pc_lock);
+		coremap_free(paddr);
+		if (pce != NULL) {
+			kfree(pce);
+		}
+		return paddr;
+	}
+	if (pce == NULL) {
+		/* Out of memory; just don't cache it. */
+		spinlock_release(&pc_lock);
+		return paddr;
+	}
+
+	VOP_INCREF(v);
+	coremap_incref(paddr);
+	pce->pce_vnode = v;
+	pce->pce_offset = offset;
+	pce->pce_fstart = fstart;
+	pce->pce_fend = fend;
+	pce->pce_paddr = paddr;
+	h = pc_hash(v, offset);
+	pce->pce_next = pc_table[h];
+	pc_table[h] = pce;
+	pc_npages++;
+	spinlock_release(&pc_lock);
+	return paddr;
+}
+
+/*
+ * Forget every page of V, or of every vnode if V is NULL.
+ */
+static
+void
+pc_invalidate(struct vnode *v)
+{
+	struct pc_entry *pce, **pcep, *dead;
+	unsigned i;
+
+	dead = NULL;
+	spinlock_acquire(&pc_lock);
+	for (i = 0; i < PC_NBUCKETS; i++) {
+		pcep = &pc_table[i];
+		while ((pce = *pcep) != NULL) {
+			if (v == NULL || pce->pce_vnode == v) {
+				*pcep = pce->pce_next;
+				pce->pce_next = dead;
+				dead = pce;
+				pc_npages--;
+			}
+			else {
+				pcep = &pce->pce_next;
+			}
+		}
+	}
+	spinlock_release(&pc_lock);
+
+	pc_droplist(dead);
+}
+
+void
+pagecache_invalidate(struct vnode *v)
+{
+	KASSERT(v != NULL);
+	pc_invalidate(v);
+}
+
+void
+pagecache_flush(void)
+{
+	pc_invalidate(NULL);
+}
+
+unsigned
+pagecache_reclaim(void)
+{
+	struct pc_entry *pce, **pcep, *dead;
+	unsigned i, n;
+
+	dead = NULL;
+	n = 0;
+	spinlock_acquire(&pc_lock);
+	for (i = 0; i < PC_NBUCKETS; i++) {
+		pcep = &pc_table[i];
+		while ((pce = *pcep) != NULL) {
+			/*
+			 * Nobody else can get a reference without
+			 * going through us, so this can't change.
+			 */
+			if (coremap_refcount(pce->pce_paddr) == 1) {
+				*pcep = pce->pce_next;
+				pce->pce_next = dead;
+				dead = pce;
+				pc_npages--;
+				n++;
+			}
+			else {
+				pcep = &pce->pce_next;
+			}
+		}
+	}
+	spinlock_release(&pc_lock);
+
+	pc_droplist(dead);
+	return n;
+}
+
+void
+pagecache_printstats(void)
+{
+	unsigned npages, hits, misses;
+
+	spinlock_acquire(&pc_lock);
+	npages = pc_npages;
+	hits = pc_hits;
+	misses = pc_misses;
+	spinlock_release(&pc_lock);
+
+	kprintf("Page cache: %u pages: %u hits, %u misses\n",
+		npages, hits, misses);
+}
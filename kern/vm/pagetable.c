@@ -0,0 +1,281 @@
+/*
+ * Two-level user page tables.
+ *
+ * The directory lives in the pagetable structure itself; second-level
+ * tables are kmalloc'd a page at a time on first use and not freed
+ * until the page table is destroyed, so pointers to PTEs stay good
+ * for the life of the page table.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <swap.h>
+
+#define PT_L1INDEX(va)  ((va) >> PT_L1SHIFT)
+#define PT_L2INDEX(va)  (((va) >> PT_L2SHIFT) & (PT_L2ENTRIES - 1))
+
+/* Where threads wait for busy PTEs. */
+static struct wchan *pt_busywchan;
+
+void
+pt_bootstrap(void)
+{
+	pt_busywchan = wchan_create("ptbusy");
+	if (pt_busywchan == NULL) {
+		panic("pt_bootstrap: Out of memory\n");
+	}
+}
+
+void
+pt_waitbusy(pte_t *pte)
+{
+	wchan_lock(pt_busywchan);
+	while (*pte & PTE_BUSY) {
+		wchan_sleep(pt_busywchan);
+		wchan_lock(pt_busywchan);
+	}
+	wchan_unlock(pt_busywchan);
+}
+
+void
+pt_setentry(pte_t *pte, pte_t val)
+{
+	KASSERT(*pte & PTE_BUSY);
+	KASSERT(!(val & PTE_BUSY));
+
+	wchan_lock(pt_busywchan);
+	*pte = val;
+	wchan_unlock(pt_busywchan);
+	wchan_wakeall(pt_busywchan);
+}
+
+struct pagetable *
+pt_create(void)
+{
+	struct pagetable *pt;
+
+	pt = kmalloc(sizeof(struct pagetable));
+	if (pt == NULL) {
+		return NULL;
+	}
+	spinlock_init(&pt->pt_lock);
+	bzero(pt->pt_dir, sizeof(pt->pt_dir));
+	return pt;
+}
+
+void
+pt_destroy(struct pagetable *pt)
+{
+	unsigned i, j;
+	pte_t *l2;
+
+	for (i=0; i<PT_L1ENTRIES; i++) {
+		l2 = pt->pt_dir[i];
+		if (l2 == NULL) {
+			continue;
+		}
+		for (j=0; j<PT_L2ENTRIES; j++) {
+			if (l2[j] & PTE_BUSY) {
+				pt_waitbusy(&l2[j]);
+			}
+			if (l2[j] & PTE_VALID) {
+				coremap_free(l2[j] & PTE_FRAME);
+			}
+			else if (l2[j] & PTE_SWAPPED) {
+				swap_free(PTE_SLOT(l2[j]));
+			}
+		}
+		kfree(l2);
+	}
+	spinlock_cleanup(&pt->pt_lock);
+	kfree(pt);
+}
+
+pte_t *
+pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create)
+{
+	pte_t *l2;
+
+	KASSERT(vaddr < USERSPACETOP);
+
+	l2 = pt->pt_dir[PT_L1INDEX(vaddr)];
+	if (l2 == NULL) {
+		if (!create) {
+			return NULL;
+		}
+		l2 = kmalloc(PT_L2ENTRIES * sizeof(pte_t));
+		if (l2 == NULL) {
+			return NULL;
+		}
+		bzero(l2, PT_L2ENTRIES * sizeof(pte_t));
+		pt->pt_dir[PT_L1INDEX(vaddr)] = l2;
+	}
+	return &l2[PT_L2INDEX(vaddr)];
+}
+
+void
+pt_unmap(struct pagetable *pt, vaddr_t vaddr)
+{
+	pte_t *pte;
+
+	pte = pt_lookup(pt, vaddr, false);
+	if (pte == NULL) {
+		return;
+	}
+
+	while (1) {
+		if (*pte & PTE_BUSY) {
+			pt_waitbusy(pte);
+			continue;
+		}
+
+		/*
+		 * Clear the entry and drop the frame (which forgets its
+		 * owner) together, unless the frame has just been picked
+		 * for eviction; then wait for the entry to go busy.
+		 */
+		spinlock_acquire(&pt->pt_lock);
+		if (*pte & PTE_BUSY || (*pte & PTE_VALID &&
+		    coremap_isbusy(*pte & PTE_FRAME))) {
+			spinlock_release(&pt->pt_lock);
+			continue;
+		}
+		if (*pte & PTE_VALID) {
+			coremap_free(*pte & PTE_FRAME);
+		}
+		else if (*pte & PTE_SWAPPED) {
+			swap_free(PTE_SLOT(*pte));
+		}
+		*pte = 0;
+		spinlock_release(&pt->pt_lock);
+		return;
+	}
+}
+
+/*
+ * Copy one PTE for pt_copy.
+ */
+static
+int
+pt_copyentry(struct pagetable *pt, pte_t *opte, pte_t *npte, bool cow)
+{
+	uint32_t slot;
+	int result;
+
+	while (1) {
+		if (*opte & PTE_BUSY) {
+			pt_waitbusy(opte);
+			continue;
+		}
+		if (*opte & PTE_SWAPPED) {
+			/* Only we swap our pages back in, so this holds. */
+			result = swap_dup(PTE_SLOT(*opte), &slot);
+			if (result) {
+				return result;
+			}
+			*npte = PTE_MKSWAP(slot) |
+				(*opte & (PTE_WRITE | PTE_DIRTY));
+			return 0;
+		}
+
+		/*
+		 * The page stops being evictable once it's shared, so
+		 * share it under the lock the evictor takes to mark it
+		 * busy, and back off if it has already been picked.
+		 */
+		spinlock_acquire(&pt->pt_lock);
+		if (*opte & PTE_VALID) {
+			if (coremap_isbusy(*opte & PTE_FRAME)) {
+				spinlock_release(&pt->pt_lock);
+				continue;
+			}
+			coremap_incref(*opte & PTE_FRAME);
+			if (cow) {
+				*opte = (*opte & ~PTE_WRITE) | PTE_COW;
+			}
+			*npte = *opte;
+			spinlock_release(&pt->pt_lock);
+			return 0;
+		}
+		spinlock_release(&pt->pt_lock);
+
+		if (*opte == 0) {
+			/* never touched */
+			return 0;
+		}
+		/* Evicted before we got to it; go around again. */
+	}
+}
+
+int
+pt_copy(struct pagetable *old, struct pagetable *new,
+	vaddr_t start, vaddr_t end, bool cow)
+{
+	vaddr_t va;
+	pte_t *opte, *npte;
+	int result;
+
+	KASSERT(start % PAGE_SIZE == 0 && end % PAGE_SIZE == 0);
+
+	va = start;
+	while (va < end) {
+		if (old->pt_dir[PT_L1INDEX(va)] == NULL) {
+			/* Skip to the next second-level table. */
+			va = (PT_L1INDEX(va) + 1) << PT_L1SHIFT;
+			if (va == 0) {
+				break;
+			}
+			continue;
+		}
+		opte = pt_lookup(old, va, false);
+		if (*opte != 0) {
+			npte = pt_lookup(new, va, true);
+			if (npte == NULL) {
+				/* The caller destroys NEW. */
+				return ENOMEM;
+			}
+			KASSERT(*npte == 0);
+			result = pt_copyentry(old, opte, npte, cow);
+			if (result) {
+				return result;
+			}
+		}
+		va += PAGE_SIZE;
+	}
+	return 0;
+}
+
+int
+pt_share(struct pagetable *old, struct pagetable *new, vaddr_t vaddr)
+{
+	pte_t *opte, *npte;
+
+	npte = pt_lookup(new, vaddr, true);
+	if (npte == NULL) {
+		return ENOMEM;
+	}
+	KASSERT(*npte == 0);
+	opte = pt_lookup(old, vaddr, false);
+	if (opte == NULL) {
+		return EAGAIN;
+	}
+
+	/* As in pt_copyentry: not once the evictor has picked it. */
+	spinlock_acquire(&old->pt_lock);
+	if (!(*opte & PTE_VALID) || coremap_isbusy(*opte & PTE_FRAME)) {
+		spinlock_release(&old->pt_lock);
+		return EAGAIN;
+	}
+	KASSERT(!(*opte & PTE_COW));
+	coremap_incref(*opte & PTE_FRAME);
+	/* NEW hasn't written it; it finds out when it does. */
+	*npte = *opte & ~(PTE_WRITE | PTE_DIRTY);
+	spinlock_release(&old->pt_lock);
+	return 0;
+}
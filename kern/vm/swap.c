@@ -0,0 +1,200 @@
+/*
+ * Swap space on a raw disk.
+ *
+ * The device is treated as an array of page-sized slots; which slots
+ * hold pages is kept in a bitmap. The disk driver serializes the
+ * actual I/O, so all we need to lock is the bitmap.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <bitmap.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <vm.h>
+#include <swap.h>
+#include <uw-vmstats.h>
+
+static struct vnode *swap_vnode;
+static struct bitmap *swap_map;
+static uint32_t swap_nslots;
+static uint32_t swap_nused;
+
+/* Protects swap_map and swap_nused. */
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+
+void
+swap_bootstrap(void)
+{
+	char path[sizeof(SWAP_DEVICE)];
+	struct stat st;
+	int result;
+
+	/* vfs_open destroys the string it's passed. */
+	strcpy(path, SWAP_DEVICE);
+	result = vfs_open(path, O_RDWR, 0, &swap_vnode);
+	if (result) {
+		kprintf("swap: %s: %s; running without swap\n",
+			SWAP_DEVICE, strerror(result));
+		swap_vnode = NULL;
+		return;
+	}
+
+	result = VOP_STAT(swap_vnode, &st);
+	if (result) {
+		panic("swap: stat %s: %s\n", SWAP_DEVICE, strerror(result));
+	}
+	swap_nslots = st.st_size / PAGE_SIZE;
+	if (swap_nslots == 0) {
+		kprintf("swap: %s is too small; running without swap\n",
+			SWAP_DEVICE);
+		vfs_close(swap_vnode);
+		swap_vnode = NULL;
+		return;
+	}
+
+	swap_map = bitmap_create(swap_nslots);
+	if (swap_map == NULL) {
+		panic("swap: Out of memory for the swap bitmap\n");
+	}
+	swap_nused = 0;
+
+	kprintf("swap: %u slots (%uk) on %s\n", swap_nslots,
+		swap_nslots * (PAGE_SIZE / 1024), SWAP_DEVICE);
+}
+
+bool
+swap_enabled(void)
+{
+	return swap_vnode != NULL;
+}
+
+int
+swap_alloc(uint32_t *slot)
+{
+	unsigned index;
+	int result;
+
+	KASSERT(swap_enabled());
+
+	spinlock_acquire(&swap_lock);
+	result = bitmap_alloc(swap_map, &index);
+	if (result == 0) {
+		swap_nused++;
+	}
+	spinlock_release(&swap_lock);
+
+	*slot = index;
+	return result;
+}
+
+void
+swap_free(uint32_t slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(bitmap_isset(swap_map, slot));
+	bitmap_unmark(swap_map, slot);
+	swap_nused--;
+	spinlock_release(&swap_lock);
+}
+
+/*
+ * Transfer one page between kernel buffer KBUF and SLOT.
+ */
+static
+int
+swap_io(void *kbuf, uint32_t slot, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT(slot < swap_nslots);
+
+	uio_kinit(&iov, &ku, kbuf, PAGE_SIZE, (off_t)slot * PAGE_SIZE, rw);
+	if (rw == UIO_READ) {
+		result = VOP_READ(swap_vnode, &ku);
+	}
+	else {
+		result = VOP_WRITE(swap_vnode, &ku);
+	}
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return EIO;
+	}
+	return 0;
+}
+
+int
+swap_in(uint32_t slot, paddr_t paddr)
+{
+	return swap_io((void *)PADDR_TO_KVADDR(paddr), slot, UIO_READ);
+}
+
+int
+swap_out(paddr_t paddr, uint32_t slot)
+{
+	int result;
+
+	result = swap_io((void *)PADDR_TO_KVADDR(paddr), slot, UIO_WRITE);
+	if (result) {
+		return result;
+	}
+	vmstats_inc(VMSTAT_SWAP_FILE_WRITE);
+	return 0;
+}
+
+int
+swap_dup(uint32_t slot, uint32_t *newslot)
+{
+	void *buf;
+	int result;
+
+	buf = kmalloc(PAGE_SIZE);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+
+	result = swap_alloc(newslot);
+	if (result) {
+		kfree(buf);
+		return result;
+	}
+
+	result = swap_io(buf, slot, UIO_READ);
+	if (result == 0) {
+		result = swap_io(buf, *newslot, UIO_WRITE);
+	}
+	kfree(buf);
+	if (result) {
+		swap_free(*newslot);
+	}
+	return result;
+}
+
+void
+swap_printstats(void)
+{
+	uint32_t nused;
+
+	if (!swap_enabled()) {
+		kprintf("Swap: none\n");
+		return;
+	}
+
+	spinlock_acquire(&swap_lock);
+	nused = swap_nused;
+	spinlock_release(&swap_lock);
+
+	kprintf("Swap: %u slots: %u used, %u free\n",
+		swap_nslots, nused, swap_nslots - nused);
+}
@@ -2,24 +2,19 @@
 
 /* belongs in kern/vm/uw-vmstats.c */
 
-/* NOTE !!!!!! WARNING !!!!!
- * All of the functions whose names begin with '_'
- * assume that atomicity is ensured elsewhere
- * (i.e., outside of these routines) by acquiring stats_lock.
- * All of the functions whose names do not begin
- * with '_' ensure atomicity locally.
+/* NOTE: the counts are kept per-cpu (see cpustat.h), so counting
+ * takes no lock and the functions whose names begin with '_' are
+ * now the same as the ones that don't. They are kept for callers
+ * that already use them.
  */
 
 #include <types.h>
 #include <lib.h>
-#include <synch.h>
-#include <spl.h>
+#include <cpustat.h>
 #include <uw-vmstats.h>
 
-/* Counters for tracking statistics */
-static unsigned int stats_counts[VMSTAT_COUNT];
-
-struct spinlock stats_lock = SPINLOCK_INITIALIZER;
+/* Counters for tracking statistics live in struct cpu. */
+#define stats_count(i)  cpustat_get(CPUSTAT_VM + (i))
 
 /* Strings used in printing out the statistics */
 static const char *stats_names[] = {
@@ -33,6 +28,11 @@ static const char *stats_names[] = {
  /*  7 */ "Page Faults from ELF",
  /*  8 */ "Page Faults from Swapfile",
  /*  9 */ "Swapfile Writes",
+ /* 10 */ "TLB Flushes Avoided",
+ /* 11 */ "ASID Rollovers",
+ /* 12 */ "TLB Shootdowns",
+ /* 13 */ "TLB Fault-around Loads",
+ /* 14 */ "Page Faults from mmap",
 };
 
 
@@ -41,23 +41,15 @@ static const char *stats_names[] = {
 void
 vmstats_inc(unsigned int index)
 {
-    spinlock_acquire(&stats_lock);
-      _vmstats_inc(index);
-    spinlock_release(&stats_lock);
+  _vmstats_inc(index);
 }
 
 /* ---------------------------------------------------------------------- */
 void
 vmstats_init(void)
 {
-  /* Although the spinlock is initialized at declaration time we do it here
-   * again in case we want use/reset these stats repeatedly without shutting down the kernel.
-   */
-  spinlock_init(&stats_lock);
-
-  spinlock_acquire(&stats_lock);
-    _vmstats_init();
-  spinlock_release(&stats_lock);
+  /* Can be called again to reset the stats without shutting down the kernel. */
+  _vmstats_init();
 }
 
 /* ---------------------------------------------------------------------- */
@@ -65,7 +57,7 @@ void
 _vmstats_inc(unsigned int index)
 {
   KASSERT(index < VMSTAT_COUNT);
-  stats_counts[index]++;
+  cpustat_inc(CPUSTAT_VM + index);
 }
 
 /* ---------------------------------------------------------------------- */
@@ -81,16 +73,15 @@ _vmstats_init(void)
   }
 
   for (i=0; i<VMSTAT_COUNT; i++) {
-    stats_counts[i] = 0;
+    cpustat_reset(CPUSTAT_VM + i);
   }
 
 }
 
 /* ---------------------------------------------------------------------- */
 /* Assumes vmstat_init has already been called */
-/* NOTE: We do not grab the spinlock here because kprintf may block
- * and we can't block while holding a spinlock.
- * Just use this when there is only one thread remaining.
+/* NOTE: The counts are summed over the cpus without locking, so the
+ * totals only add up exactly when nothing else is running.
  */
 
 void
@@ -100,20 +91,21 @@ vmstats_print(void)
   int free_plus_replace = 0;
   int disk_plus_zeroed_plus_reload = 0;
   int tlb_faults = 0;
-  int elf_plus_swap_reads = 0;
+  int file_plus_swap_reads = 0;
   int disk_reads = 0;
 
   kprintf("VMSTATS:\n");
   for (i=0; i<VMSTAT_COUNT; i++) {
-    kprintf("VMSTAT %25s = %10d\n", stats_names[i], stats_counts[i]);
+    kprintf("VMSTAT %25s = %10d\n", stats_names[i], stats_count(i));
   }
 
-  tlb_faults = stats_counts[VMSTAT_TLB_FAULT];
-  free_plus_replace = stats_counts[VMSTAT_TLB_FAULT_FREE] + stats_counts[VMSTAT_TLB_FAULT_REPLACE];
-  disk_plus_zeroed_plus_reload = stats_counts[VMSTAT_PAGE_FAULT_DISK] +
-    stats_counts[VMSTAT_PAGE_FAULT_ZERO] + stats_counts[VMSTAT_TLB_RELOAD];
-  elf_plus_swap_reads = stats_counts[VMSTAT_ELF_FILE_READ] + stats_counts[VMSTAT_SWAP_FILE_READ];
-  disk_reads = stats_counts[VMSTAT_PAGE_FAULT_DISK];
+  tlb_faults = stats_count(VMSTAT_TLB_FAULT);
+  free_plus_replace = stats_count(VMSTAT_TLB_FAULT_FREE) + stats_count(VMSTAT_TLB_FAULT_REPLACE);
+  disk_plus_zeroed_plus_reload = stats_count(VMSTAT_PAGE_FAULT_DISK) +
+    stats_count(VMSTAT_PAGE_FAULT_ZERO) + stats_count(VMSTAT_TLB_RELOAD);
+  file_plus_swap_reads = stats_count(VMSTAT_ELF_FILE_READ) +
+    stats_count(VMSTAT_MMAP_FILE_READ) + stats_count(VMSTAT_SWAP_FILE_READ);
+  disk_reads = stats_count(VMSTAT_PAGE_FAULT_DISK);
 
   kprintf("VMSTAT TLB Faults with Free + TLB Faults with Replace = %d\n", free_plus_replace);
   if (tlb_faults != free_plus_replace) {
@@ -128,10 +120,11 @@ vmstats_print(void)
       tlb_faults, disk_plus_zeroed_plus_reload); 
   }
 
-  kprintf("VMSTAT ELF File reads + Swapfile reads = %d\n", elf_plus_swap_reads);
-  if (disk_reads != elf_plus_swap_reads) {
-    kprintf("WARNING: ELF File reads + Swapfile reads != Page Faults (Disk) %d\n",
-      elf_plus_swap_reads);
+  kprintf("VMSTAT ELF File reads + mmap File reads + Swapfile reads = %d\n",
+    file_plus_swap_reads);
+  if (disk_reads != file_plus_swap_reads) {
+    kprintf("WARNING: ELF File reads + mmap File reads + Swapfile reads != Page Faults (Disk) %d\n",
+      file_plus_swap_reads);
   }
 }
 /* ---------------------------------------------------------------------- */
@@ -354,26 +354,16 @@ docommand(char *buf)
 		__time(&startsecs, &startnsecs);
 	}
 
-	pid = fork();
-	switch (pid) {
-		case -1:
-			/* error */
-			warn("fork");
-			return _MKWAIT_EXIT(255);
-		case 0:
-			/* child */
-			execv(args[0], args);
-			warn("%s", args[0]);
-			/*
-			 * Use _exit() instead of exit() in the child
-			 * process to avoid calling atexit() functions,
-			 * which would cause hostcompat (if present) to
-			 * reset the tty state and mess up our input
-			 * handling.
-			 */
-			_exit(1);
-		default:
-			break;
+	/*
+	 * spawn creates the child and loads the program in one go,
+	 * without copying our address space for fork only to throw
+	 * the copy away in execv. If the program can't be run, we
+	 * get the error here rather than from a child that exits.
+	 */
+	pid = spawn(args[0], args);
+	if (pid < 0) {
+		warn("%s", args[0]);
+		return _MKWAIT_EXIT(1);
 	}
 
 	/* parent */
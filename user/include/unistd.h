@@ -39,6 +39,7 @@
  */
 #include <kern/fcntl.h>
 #include <kern/ioctl.h>
+#include <kern/mman.h>
 #include <kern/reboot.h>
 #include <kern/seek.h>
 #include <kern/time.h>
@@ -118,6 +119,7 @@
 __DEAD void _exit(int code);
 int execv(const char *prog, char *const *args);
 pid_t fork(void);
+pid_t spawn(const char *prog, char *const *args);
 int waitpid(pid_t pid, int *returncode, int flags);
 /* 
  * Open actually takes either two or three args: the optional third
@@ -147,6 +149,10 @@ int chdir(const char *path);
 
 /* Optional. */
 void *sbrk(int change);
+void *mmap(void *addr, size_t len, int prot, int flags, int filehandle,
+	   off_t offset);
+int munmap(void *addr, size_t len);
+int msync(void *addr, size_t len, int flags);
 int getdirentry(int filehandle, char *buf, size_t buflen);
 int symlink(const char *target, const char *linkname);
 int readlink(const char *path, char *buf, size_t buflen);
@@ -32,6 +32,7 @@
  */
 
 #include <sys/types.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
@@ -139,6 +140,22 @@ exec_onearg(void *ptr, const char *desc)
 	exit(MAGIC_STATUS);
 }
 
+/*
+ * A misaligned arglist in the last bytes of a page, so that not even
+ * one whole pointer fits before the page boundary.
+ */
+static
+void
+exec_misalignedargs(void)
+{
+	static char buf[3 * 4096];
+	uintptr_t page;
+
+	page = ((uintptr_t)buf + 4096 * 2 - 1) & ~(uintptr_t)(4096 - 1);
+	exec_badargs((void *)(page - 2),
+		     "exec /bin/true with misaligned arglist at page end");
+}
+
 void
 test_execv(void)
 {
@@ -151,6 +168,7 @@ test_execv(void)
 	exec_badargs(NULL, "exec /bin/true with NULL arglist");
 	exec_badargs(INVAL_PTR, "exec /bin/true with invalid pointer arglist");
 	exec_badargs(KERN_PTR, "exec /bin/true with kernel pointer arglist");
+	exec_misalignedargs();
 
 	exec_onearg(INVAL_PTR, "exec /bin/true with invalid pointer arg");
 	exec_onearg(KERN_PTR, "exec /bin/true with kernel pointer arg");
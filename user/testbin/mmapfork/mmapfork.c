@@ -0,0 +1,148 @@
+/*
+ * mmapfork - check what a forked child shares through mmap.
+ *
+ * Makes a shared and a private anonymous mapping, and a private
+ * writeable mapping of a file, touches some of their pages and not
+ * others, and forks. The child checks it sees what the parent wrote,
+ * then writes over everything. Afterwards the parent must see the
+ * child's writes in the shared mapping, every page of it, and none
+ * of them in the private ones.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+#define PAGE     4096
+#define NPAGES   3
+#define MAPFILE  "/bin/true"
+
+static
+char *
+domap(int flags, int fd)
+{
+	void *p;
+
+	p = mmap(NULL, NPAGES * PAGE, PROT_READ | PROT_WRITE, flags, fd, 0);
+	if (p == MAP_FAILED) {
+		err(1, "mmap");
+	}
+	return p;
+}
+
+/*
+ * Check that page PAGENUM of the mapping at P holds VAL throughout.
+ */
+static
+int
+checkpage(const char *what, const char *p, unsigned pagenum, char val)
+{
+	unsigned i;
+
+	for (i=0; i<PAGE; i++) {
+		if (p[pagenum * PAGE + i] != val) {
+			warnx("%s page %u byte %u: expected %d, found %d",
+			      what, pagenum, i, val, p[pagenum * PAGE + i]);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static
+void
+fill(char *p, unsigned pagenum, char val)
+{
+	unsigned i;
+
+	for (i=0; i<PAGE; i++) {
+		p[pagenum * PAGE + i] = val;
+	}
+}
+
+int
+main(void)
+{
+	char *shared, *private, *file;
+	char magic[4];
+	volatile char c;
+	int fd, bad, status;
+	unsigned i;
+	pid_t pid;
+
+	shared = domap(MAP_SHARED | MAP_ANON, -1);
+	private = domap(MAP_PRIVATE | MAP_ANON, -1);
+	fd = open(MAPFILE, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", MAPFILE);
+	}
+	file = domap(MAP_PRIVATE, fd);
+	close(fd);
+	for (i=0; i<4; i++) {
+		magic[i] = file[i];
+	}
+
+	/* Page 0 written, page 1 only read, page 2 never touched. */
+	fill(shared, 0, 1);
+	fill(private, 0, 1);
+	c = shared[PAGE];
+	c = private[PAGE];
+	(void)c;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		bad = checkpage("child: shared", shared, 0, 1);
+		bad |= checkpage("child: private", private, 0, 1);
+		for (i=1; i<NPAGES; i++) {
+			bad |= checkpage("child: shared", shared, i, 0);
+			bad |= checkpage("child: private", private, i, 0);
+		}
+		for (i=0; i<4; i++) {
+			if (file[i] != magic[i]) {
+				warnx("child: file byte %u differs", i);
+				bad = 1;
+			}
+		}
+		for (i=0; i<NPAGES; i++) {
+			fill(shared, i, 2);
+			fill(private, i, 2);
+			fill(file, i, 2);
+		}
+		_exit(bad);
+	}
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	bad = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+	if (bad) {
+		warnx("child failed");
+	}
+
+	for (i=0; i<NPAGES; i++) {
+		bad |= checkpage("shared", shared, i, 2);
+	}
+	bad |= checkpage("private", private, 0, 1);
+	for (i=1; i<NPAGES; i++) {
+		bad |= checkpage("private", private, i, 0);
+	}
+	for (i=0; i<4; i++) {
+		if (file[i] != magic[i]) {
+			warnx("file byte %u changed", i);
+			bad = 1;
+		}
+	}
+
+	if (bad) {
+		errx(1, "FAILED");
+	}
+	printf("mmapfork: passed\n");
+	return 0;
+}
@@ -0,0 +1,284 @@
+/*
+ * mmaptest - test mmap and munmap.
+ *
+ * Checks that shared and private anonymous mappings read as zeroes
+ * and keep what is written to them, that a private mapping of a file
+ * shows the file, that writes to a shared mapping of a file reach the
+ * file through msync and munmap, and that mmap and munmap reject bad
+ * arguments with the right error: bad lengths, protections, flags,
+ * descriptors and offsets. Unmapping part of a mapping may or may not
+ * work, but must leave the rest of it alone.
+ *
+ * The shared mapping test writes over the first page of MAPFILE and
+ * then puts it back.
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+
+#define PAGE     4096
+#define MAPFILE  "/bin/true"
+
+static int failures;
+
+static
+void
+expect_map(void *p, int err, const char *desc)
+{
+	if (p != MAP_FAILED) {
+		warnx("FAILURE: %s: mmap succeeded", desc);
+		failures++;
+	}
+	else if (errno != err) {
+		warnx("FAILURE: %s: wrong error: %s", desc, strerror(errno));
+		failures++;
+	}
+}
+
+static
+void
+expect_unmap(int rv, int err, const char *desc)
+{
+	if (rv == 0 && err != 0) {
+		warnx("FAILURE: %s: munmap succeeded", desc);
+		failures++;
+	}
+	else if (rv != 0 && err == 0) {
+		warn("FAILURE: %s: munmap", desc);
+		failures++;
+	}
+	else if (rv != 0 && errno != err) {
+		warnx("FAILURE: %s: wrong error: %s", desc, strerror(errno));
+		failures++;
+	}
+}
+
+/*
+ * Check that a fresh anonymous mapping of NPAGES pages reads as zero
+ * and keeps a pattern written over it.
+ */
+static
+void
+test_anon(int flags, const char *desc)
+{
+	unsigned char *p;
+	unsigned npages = 4, i;
+
+	p = mmap(NULL, npages * PAGE, PROT_READ | PROT_WRITE,
+		 flags | MAP_ANON, -1, 0);
+	if (p == MAP_FAILED) {
+		warn("FAILURE: %s: mmap", desc);
+		failures++;
+		return;
+	}
+	for (i=0; i<npages * PAGE; i++) {
+		if (p[i] != 0) {
+			warnx("FAILURE: %s: byte %u not zero", desc, i);
+			failures++;
+			break;
+		}
+	}
+	for (i=0; i<npages * PAGE; i++) {
+		p[i] = i % 251;
+	}
+	for (i=0; i<npages * PAGE; i++) {
+		if (p[i] != i % 251) {
+			warnx("FAILURE: %s: byte %u lost", desc, i);
+			failures++;
+			break;
+		}
+	}
+	expect_unmap(munmap(p, npages * PAGE), 0, desc);
+}
+
+static
+void
+test_file(void)
+{
+	char *p;
+	int fd;
+
+	fd = open(MAPFILE, O_RDONLY);
+	if (fd < 0) {
+		warn("FAILURE: %s", MAPFILE);
+		failures++;
+		return;
+	}
+
+	p = mmap(NULL, PAGE, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED) {
+		warn("FAILURE: private file mapping: mmap");
+		failures++;
+	}
+	else {
+		if (p[0] != 0x7f || p[1] != 'E' || p[2] != 'L' ||
+		    p[3] != 'F') {
+			warnx("FAILURE: private file mapping: not the file");
+			failures++;
+		}
+		expect_unmap(munmap(p, PAGE), 0, "private file mapping");
+	}
+
+	expect_map(mmap(NULL, PAGE, PROT_READ | PROT_WRITE, MAP_SHARED,
+			fd, 0),
+		   EACCES, "shared writeable mapping of read-only file");
+	expect_map(mmap(NULL, PAGE, PROT_READ, MAP_PRIVATE, fd, 1),
+		   EINVAL, "unaligned offset");
+	expect_map(mmap(NULL, PAGE, PROT_READ, MAP_PRIVATE, fd, -PAGE),
+		   EINVAL, "negative offset");
+
+	close(fd);
+}
+
+/*
+ * Check that the first page of MAPFILE, read through a fresh private
+ * mapping, holds DATA.
+ */
+static
+void
+checkfile(const unsigned char *data, const char *desc)
+{
+	unsigned char *q;
+	int fd, i;
+
+	fd = open(MAPFILE, O_RDONLY);
+	if (fd < 0) {
+		warn("FAILURE: %s: %s", desc, MAPFILE);
+		failures++;
+		return;
+	}
+	q = mmap(NULL, PAGE, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (q == MAP_FAILED) {
+		warn("FAILURE: %s: mmap", desc);
+		failures++;
+		return;
+	}
+	for (i=0; i<PAGE; i++) {
+		if (q[i] != data[i]) {
+			warnx("FAILURE: %s: byte %d not in the file", desc, i);
+			failures++;
+			break;
+		}
+	}
+	expect_unmap(munmap(q, PAGE), 0, desc);
+}
+
+static
+void
+test_sharedfile(void)
+{
+	static unsigned char save[PAGE], flipped[PAGE];
+	unsigned char *p;
+	int fd, i;
+
+	fd = open(MAPFILE, O_RDWR);
+	if (fd < 0) {
+		warn("FAILURE: %s (read/write)", MAPFILE);
+		failures++;
+		return;
+	}
+	p = mmap(NULL, PAGE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		warn("FAILURE: shared file mapping: mmap");
+		failures++;
+		return;
+	}
+
+	for (i=0; i<PAGE; i++) {
+		save[i] = p[i];
+		flipped[i] = ~save[i];
+		p[i] = flipped[i];
+	}
+	if (msync(p, PAGE, MS_SYNC) < 0) {
+		warn("FAILURE: shared file mapping: msync");
+		failures++;
+	}
+	checkfile(flipped, "shared file mapping after msync");
+
+	/* Put the file back, this time by unmapping. */
+	for (i=0; i<PAGE; i++) {
+		p[i] = save[i];
+	}
+	expect_unmap(munmap(p, PAGE), 0, "shared file mapping");
+	checkfile(save, "shared file mapping after munmap");
+}
+
+static
+void
+test_badmap(void)
+{
+	expect_map(mmap(NULL, 0, PROT_READ, MAP_PRIVATE | MAP_ANON, -1, 0),
+		   EINVAL, "zero length");
+	expect_map(mmap(NULL, (size_t)-1, PROT_READ, MAP_PRIVATE | MAP_ANON,
+			-1, 0),
+		   ENOMEM, "length near SIZE_MAX");
+	expect_map(mmap(NULL, PAGE, 0x100, MAP_PRIVATE | MAP_ANON, -1, 0),
+		   EINVAL, "bad prot");
+	expect_map(mmap(NULL, PAGE, PROT_READ, MAP_ANON, -1, 0),
+		   EINVAL, "neither shared nor private");
+	expect_map(mmap(NULL, PAGE, PROT_READ, MAP_SHARED | MAP_PRIVATE,
+			-1, 0),
+		   EINVAL, "both shared and private");
+	expect_map(mmap(NULL, PAGE, PROT_READ, MAP_PRIVATE, -1, 0),
+		   EBADF, "fd -1");
+	expect_map(mmap(NULL, PAGE, PROT_READ, MAP_PRIVATE, 1000, 0),
+		   EBADF, "fd 1000");
+}
+
+static
+void
+test_badunmap(void)
+{
+	char *p;
+
+	p = mmap(NULL, 3 * PAGE, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (p == MAP_FAILED) {
+		warn("FAILURE: mmap for munmap tests");
+		failures++;
+		return;
+	}
+
+	p[PAGE] = 1;
+	p[2 * PAGE] = 2;
+
+	expect_unmap(munmap(p + 1, 3 * PAGE), EINVAL, "unaligned address");
+	expect_unmap(munmap(p, 0), EINVAL, "zero length");
+	expect_unmap(munmap(p, (size_t)-1), EINVAL, "length near SIZE_MAX");
+
+	/* Whether or not this works, the other pages must survive it. */
+	(void)munmap(p, PAGE);
+	if (p[PAGE] != 1 || p[2 * PAGE] != 2) {
+		warnx("FAILURE: unmapping the first page lost the others");
+		failures++;
+	}
+
+	/* An unaligned length rounds up to the same pages. */
+	expect_unmap(munmap(p, 3 * PAGE - 100), 0, "whole, unaligned length");
+	expect_unmap(munmap(p, 3 * PAGE), EINVAL, "already unmapped");
+}
+
+int
+main(void)
+{
+	test_anon(MAP_SHARED, "shared anonymous mapping");
+	test_anon(MAP_PRIVATE, "private anonymous mapping");
+	test_file();
+	test_sharedfile();
+	test_badmap();
+	test_badunmap();
+
+	if (failures > 0) {
+		errx(1, "%d failures", failures);
+	}
+	printf("mmaptest: passed\n");
+	return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * spawnbench - compare the cost of starting programs with fork and
+ * execv against spawn.
+ *
+ * Usage: spawnbench [count [program]]
+ *
+ * Runs PROGRAM (/bin/true by default) COUNT times (default 20) each
+ * way, waiting for each run to finish, and prints the total and
+ * average time per launch. The parent is made bigger than a shell
+ * usually is, so that the address space fork has to copy is not
+ * trivially small.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+#define BALLAST  (64 * 1024)
+
+static char ballast[BALLAST];
+
+static
+pid_t
+launch_fork(const char *prog, char **args)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		execv(prog, args);
+		warn("%s", prog);
+		_exit(1);
+	}
+	return pid;
+}
+
+static
+pid_t
+launch_spawn(const char *prog, char **args)
+{
+	pid_t pid;
+
+	pid = spawn(prog, args);
+	if (pid < 0) {
+		err(1, "spawn: %s", prog);
+	}
+	return pid;
+}
+
+static
+void
+bench(const char *name, pid_t (*launch)(const char *, char **),
+      const char *prog, char **args, unsigned count)
+{
+	time_t startsecs, endsecs;
+	unsigned long startnsecs, endnsecs, usecs;
+	unsigned i;
+	int status;
+	pid_t pid;
+
+	__time(&startsecs, &startnsecs);
+	for (i=0; i<count; i++) {
+		pid = launch(prog, args);
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			warnx("%s: run %u: unexpected status %d",
+			      name, i, status);
+		}
+	}
+	__time(&endsecs, &endnsecs);
+
+	if (endnsecs < startnsecs) {
+		endnsecs += 1000000000;
+		endsecs--;
+	}
+	endnsecs -= startnsecs;
+	endsecs -= startsecs;
+	usecs = (unsigned long)endsecs * 1000000 + endnsecs / 1000;
+
+	printf("%-12s %u runs: %lu.%09lu s total, %lu us per launch\n",
+	       name, count, (unsigned long)endsecs, endnsecs,
+	       usecs / count);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *prog = "/bin/true";
+	unsigned count = 20;
+	char *args[2];
+
+	if (argc > 1) {
+		count = atoi(argv[1]);
+		if (count == 0) {
+			errx(1, "Usage: spawnbench [count [program]]");
+		}
+	}
+	if (argc > 2) {
+		prog = argv[2];
+	}
+	args[0] = (char *)prog;
+	args[1] = NULL;
+
+	/* Touch the ballast so fork really has pages to share. */
+	memset(ballast, 1, sizeof(ballast));
+
+	bench("fork+execv", launch_fork, prog, args, count);
+	bench("spawn", launch_spawn, prog, args, count);
+	return 0;
+}
@@ -0,0 +1,54 @@
+/*
+ * rerun - run the same program twice, one after the other
+ *
+ *  usage: rerun [prog [args...]]   (default /bin/true)
+ *
+ *  The second run finds the program's text and read-only data
+ *  already in the page cache. Run this, then shut down: the VM
+ *  statistics printed at shutdown should show no WARNING lines.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+
+static char *defargs[] = { (char *)"/bin/true", NULL };
+
+static
+void
+runonce(char **args)
+{
+  pid_t pid;
+  int status;
+
+  pid = fork();
+  if (pid < 0) {
+    err(1, "fork");
+  }
+  if (pid == 0) {
+    execv(args[0], args);
+    err(1, "%s", args[0]);
+  }
+  if (waitpid(pid, &status, 0) < 0) {
+    err(1, "waitpid");
+  }
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    errx(1, "%s failed", args[0]);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  char **args;
+
+  args = argc > 1 ? &argv[1] : defargs;
+  runonce(args);
+  runonce(args);
+  printf("rerun: ran %s twice\n", args[0]);
+  return(0);
+}